@@ -47,6 +47,8 @@
 #  include "beecrypt/aes_le.h"
 #endif
 
+#include "aesproc.h"
+
 #ifdef ASM_AESENCRYPTECB
 extern int aesEncryptECB(aesParam*, uint32_t*, const uint32_t*, unsigned int);
 #endif
@@ -71,21 +73,13 @@ const blockCipher aes = {
 	},
 	/* ecb */
 	{
-		#ifdef ASM_AESENCRYPTECB
 		(blockCipherModcrypt) aesEncryptECB,
-		#else
-		(blockCipherModcrypt) 0,
-		#endif
-		#ifdef ASM_AESDECRYPTECB
-		(blockCipherModcrypt) aesDecryptECB,
-		#else
-		(blockCipherModcrypt) 0,
-		#endif
+		(blockCipherModcrypt) aesDecryptECB
 	},
 	/* cbc */
 	{
-		(blockCipherModcrypt) 0,
-		(blockCipherModcrypt) 0
+		(blockCipherModcrypt) aesEncryptCBC,
+		(blockCipherModcrypt) aesDecryptCBC
 	},
 	(blockCipherFeedback) aesFeedback
 };
@@ -380,6 +374,54 @@ int aesDecrypt(aesParam* ap, uint32_t* dst, const uint32_t* src)
 }
 #endif
 
+/* the backend the multi-block functions use; set by aesModesPick, see
+ * aesproc.h */
+static const aesModes* aesModesCurrent = &aesModesBitsliced;
+
+#if AES_X86
+__attribute__((constructor)) static void aesModesPick(void)
+{
+	register const aesModes* modes = aesx86Select();
+
+	if (modes != (const aesModes*) 0)
+		aesModesCurrent = modes;
+}
+#endif
+
+static const aesModes* aesModesSelect(void)
+{
+	return aesModesCurrent;
+}
+
+#ifndef ASM_AESENCRYPTECB
+int aesEncryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	return aesModesSelect()->encryptECB(ap, dst, src, nblocks);
+}
+#endif
+
+#ifndef ASM_AESDECRYPTECB
+int aesDecryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	return aesModesSelect()->decryptECB(ap, dst, src, nblocks);
+}
+#endif
+
+int aesEncryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	return aesModesSelect()->encryptCBC(ap, dst, src, nblocks);
+}
+
+int aesDecryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	return aesModesSelect()->decryptCBC(ap, dst, src, nblocks);
+}
+
+int aesCTR(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	return aesModesSelect()->ctr(ap, dst, src, nblocks);
+}
+
 uint32_t* aesFeedback(aesParam* ap)
 {
 	return ap->fdback;
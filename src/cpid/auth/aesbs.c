@@ -0,0 +1,613 @@
+/*!\file aesbs.c
+ * \brief Bitsliced AES: the multi-block modes in plain C, with no table
+ *  lookups and no branches on the key or the data.
+ *
+ *  Two blocks are spread over eight 32-bit words, word i holding bit i of
+ *  every one of their 32 bytes, and the S-box is worked out as a circuit of
+ *  AND and XOR gates on those words (Boyar and Peralta's 113 gate one), so
+ *  SubBytes takes as long for one byte value as for any other and leaves
+ *  nothing in the cache for anyone to time. ShiftRows and MixColumns turn
+ *  into shifts and rotates of the words. The layout is Thomas Pornin's
+ *  from BearSSL.
+ *
+ *  ECB, CBC decryption and CTR do two blocks per pass; CBC encryption can
+ *  only do one, since each block needs the one before it.
+ * \ingroup BC_aes_m
+ */
+
+#define BEECRYPT_DLL_EXPORT
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "aesproc.h"
+
+/*!\addtogroup BC_aes_m
+ * \{
+ */
+
+static uint32_t dec32le(const byte* b)
+{
+	return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static void enc32le(byte* b, uint32_t x)
+{
+	b[0] = (byte) (x      );
+	b[1] = (byte) (x >>  8);
+	b[2] = (byte) (x >> 16);
+	b[3] = (byte) (x >> 24);
+}
+
+#define SWAPN(cl, ch, s, x, y) \
+	a = (x); \
+	b = (y); \
+	(x) = (a & (uint32_t) (cl)) | ((b & (uint32_t) (cl)) << (s)); \
+	(y) = ((a & (uint32_t) (ch)) >> (s)) | (b & (uint32_t) (ch))
+
+#define SWAP2(x, y)	SWAPN(0x55555555, 0xAAAAAAAA, 1, x, y)
+#define SWAP4(x, y)	SWAPN(0x33333333, 0xCCCCCCCC, 2, x, y)
+#define SWAP8(x, y)	SWAPN(0x0F0F0F0F, 0xF0F0F0F0, 4, x, y)
+
+/* moves between two blocks word by word and the bitsliced form; it is its
+ * own inverse */
+static void aesbsOrtho(uint32_t* q)
+{
+	register uint32_t a, b;
+
+	SWAP2(q[0], q[1]);
+	SWAP2(q[2], q[3]);
+	SWAP2(q[4], q[5]);
+	SWAP2(q[6], q[7]);
+
+	SWAP4(q[0], q[2]);
+	SWAP4(q[1], q[3]);
+	SWAP4(q[4], q[6]);
+	SWAP4(q[5], q[7]);
+
+	SWAP8(q[0], q[4]);
+	SWAP8(q[1], q[5]);
+	SWAP8(q[2], q[6]);
+	SWAP8(q[3], q[7]);
+}
+
+static void aesbsSbox(uint32_t* q)
+{
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint32_t y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+	uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section: the inversion in GF(2^8) */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/*
+ * The S-box is S(x) = A(I(x)) ^ 0x63, with I the inversion and A an affine
+ * map; I is its own inverse, so the inverse S-box is B(S(B(x ^ 0x63)) ^
+ * 0x63) with B the inverse of A. That costs a few more XORs than a circuit
+ * of its own, and saves having one.
+ */
+static void aesbsInvAffine(uint32_t* q)
+{
+	register uint32_t q0, q1, q2, q3, q4, q5, q6, q7;
+
+	q0 = ~q[0];
+	q1 = ~q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = ~q[5];
+	q6 = ~q[6];
+	q7 = q[7];
+	q[7] = q1 ^ q4 ^ q6;
+	q[6] = q0 ^ q3 ^ q5;
+	q[5] = q7 ^ q2 ^ q4;
+	q[4] = q6 ^ q1 ^ q3;
+	q[3] = q5 ^ q0 ^ q2;
+	q[2] = q4 ^ q7 ^ q1;
+	q[1] = q3 ^ q6 ^ q0;
+	q[0] = q2 ^ q5 ^ q7;
+}
+
+static void aesbsInvSbox(uint32_t* q)
+{
+	aesbsInvAffine(q);
+	aesbsSbox(q);
+	aesbsInvAffine(q);
+}
+
+static void aesbsShiftRows(uint32_t* q)
+{
+	register uint32_t x;
+	register int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		x = q[i];
+		q[i] = (x & 0x000000FF)
+			| ((x & 0x0000FC00) >> 2) | ((x & 0x00000300) << 6)
+			| ((x & 0x00F00000) >> 4) | ((x & 0x000F0000) << 4)
+			| ((x & 0xC0000000) >> 6) | ((x & 0x3F000000) << 2);
+	}
+}
+
+static void aesbsInvShiftRows(uint32_t* q)
+{
+	register uint32_t x;
+	register int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		x = q[i];
+		q[i] = (x & 0x000000FF)
+			| ((x & 0x00003F00) << 2) | ((x & 0x0000C000) >> 6)
+			| ((x & 0x000F0000) << 4) | ((x & 0x00F00000) >> 4)
+			| ((x & 0x03000000) << 6) | ((x & 0xFC000000) >> 2);
+	}
+}
+
+#define ROT8(x)		(((x) >> 8) | ((x) << 24))
+#define ROT16(x)	(((x) >> 16) | ((x) << 16))
+
+static void aesbsMixColumns(uint32_t* q)
+{
+	register uint32_t q0, q1, q2, q3, q4, q5, q6, q7;
+	register uint32_t r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0]; r0 = ROT8(q0);
+	q1 = q[1]; r1 = ROT8(q1);
+	q2 = q[2]; r2 = ROT8(q2);
+	q3 = q[3]; r3 = ROT8(q3);
+	q4 = q[4]; r4 = ROT8(q4);
+	q5 = q[5]; r5 = ROT8(q5);
+	q6 = q[6]; r6 = ROT8(q6);
+	q7 = q[7]; r7 = ROT8(q7);
+
+	q[0] = q7 ^ r7 ^ r0 ^ ROT16(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ ROT16(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ ROT16(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ ROT16(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ ROT16(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ ROT16(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ ROT16(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ ROT16(q7 ^ r7);
+}
+
+/*
+ * InvMixColumns is MixColumns after multiplying each column by
+ * 4x^2 + 5, which in the bitsliced form is xoring in four times the sum of
+ * every byte with the one two rows away.
+ */
+static void aesbsInvMixColumns(uint32_t* q)
+{
+	register uint32_t t0, t1, t2, t3, t4, t5, t6, t7;
+
+	t0 = q[0] ^ ROT16(q[0]);
+	t1 = q[1] ^ ROT16(q[1]);
+	t2 = q[2] ^ ROT16(q[2]);
+	t3 = q[3] ^ ROT16(q[3]);
+	t4 = q[4] ^ ROT16(q[4]);
+	t5 = q[5] ^ ROT16(q[5]);
+	t6 = q[6] ^ ROT16(q[6]);
+	t7 = q[7] ^ ROT16(q[7]);
+
+	/* times x^2, reducing by x^8 + x^4 + x^3 + x + 1 on the way */
+	q[0] ^= t6;
+	q[1] ^= t6 ^ t7;
+	q[2] ^= t0 ^ t7;
+	q[3] ^= t1 ^ t6;
+	q[4] ^= t2 ^ t6 ^ t7;
+	q[5] ^= t3 ^ t7;
+	q[6] ^= t4;
+	q[7] ^= t5;
+
+	aesbsMixColumns(q);
+}
+
+static void aesbsAddRoundKey(uint32_t* q, const uint32_t* sk)
+{
+	q[0] ^= sk[0];
+	q[1] ^= sk[1];
+	q[2] ^= sk[2];
+	q[3] ^= sk[3];
+	q[4] ^= sk[4];
+	q[5] ^= sk[5];
+	q[6] ^= sk[6];
+	q[7] ^= sk[7];
+}
+
+/* the two blocks at b0 and b1 into q, bitsliced */
+static void aesbsLoad(uint32_t* q, const byte* b0, const byte* b1)
+{
+	q[0] = dec32le(b0);
+	q[2] = dec32le(b0 + 4);
+	q[4] = dec32le(b0 + 8);
+	q[6] = dec32le(b0 + 12);
+	q[1] = dec32le(b1);
+	q[3] = dec32le(b1 + 4);
+	q[5] = dec32le(b1 + 8);
+	q[7] = dec32le(b1 + 12);
+	aesbsOrtho(q);
+}
+
+static void aesbsStore(uint32_t* q, byte* b0, byte* b1)
+{
+	aesbsOrtho(q);
+	enc32le(b0,      q[0]);
+	enc32le(b0 +  4, q[2]);
+	enc32le(b0 +  8, q[4]);
+	enc32le(b0 + 12, q[6]);
+	enc32le(b1,      q[1]);
+	enc32le(b1 +  4, q[3]);
+	enc32le(b1 +  8, q[5]);
+	enc32le(b1 + 12, q[7]);
+}
+
+/*
+ * The round keys in ap->k, each spread over eight words the same way as
+ * the blocks, in sk; needs room for (nr+1)*8 words. aesSetup leaves the
+ * bytes of the key schedule in order whatever the endian-ness, so they
+ * load like a block.
+ */
+static void aesbsKeys(const aesParam* ap, uint32_t* sk)
+{
+	register const byte* rk = (const byte*) ap->k;
+	register uint32_t i;
+
+	for (i = 0; i <= ap->nr; i++, rk += 16, sk += 8)
+		aesbsLoad(sk, rk, rk);
+}
+
+static void aesbsEncrypt(uint32_t nr, const uint32_t* sk, uint32_t* q)
+{
+	register uint32_t i;
+
+	aesbsAddRoundKey(q, sk);
+	for (i = 1; i < nr; i++)
+	{
+		aesbsSbox(q);
+		aesbsShiftRows(q);
+		aesbsMixColumns(q);
+		aesbsAddRoundKey(q, sk + 8*i);
+	}
+	aesbsSbox(q);
+	aesbsShiftRows(q);
+	aesbsAddRoundKey(q, sk + 8*nr);
+}
+
+/* the equivalent inverse cipher, which is what aesSetup sets DECRYPT up for */
+static void aesbsDecrypt(uint32_t nr, const uint32_t* sk, uint32_t* q)
+{
+	register uint32_t i;
+
+	aesbsAddRoundKey(q, sk);
+	for (i = 1; i < nr; i++)
+	{
+		aesbsInvSbox(q);
+		aesbsInvShiftRows(q);
+		aesbsInvMixColumns(q);
+		aesbsAddRoundKey(q, sk + 8*i);
+	}
+	aesbsInvSbox(q);
+	aesbsInvShiftRows(q);
+	aesbsAddRoundKey(q, sk + 8*nr);
+}
+
+static void xor16(byte* dst, const byte* x, const byte* y)
+{
+	register int i;
+
+	for (i = 0; i < 16; i++)
+		dst[i] = x[i] ^ y[i];
+}
+
+/* adds one to the big-endian counter block, without a data-dependent branch */
+static void incr16(byte* ctr)
+{
+	register uint32_t carry = 1;
+	register int i;
+
+	for (i = 15; i >= 0; i--)
+	{
+		carry += ctr[i];
+		ctr[i] = (byte) carry;
+		carry >>= 8;
+	}
+}
+
+static int aesbsEncryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	uint32_t sk[120], q[8];
+	register const byte* in = (const byte*) src;
+	register byte* out = (byte*) dst;
+	byte spare[16];
+
+	aesbsKeys(ap, sk);
+
+	for (; nblocks >= 2; nblocks -= 2, in += 32, out += 32)
+	{
+		aesbsLoad(q, in, in + 16);
+		aesbsEncrypt(ap->nr, sk, q);
+		aesbsStore(q, out, out + 16);
+	}
+	if (nblocks)
+	{
+		aesbsLoad(q, in, in);
+		aesbsEncrypt(ap->nr, sk, q);
+		aesbsStore(q, out, spare);
+	}
+	return 0;
+}
+
+static int aesbsDecryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	uint32_t sk[120], q[8];
+	register const byte* in = (const byte*) src;
+	register byte* out = (byte*) dst;
+	byte spare[16];
+
+	aesbsKeys(ap, sk);
+
+	for (; nblocks >= 2; nblocks -= 2, in += 32, out += 32)
+	{
+		aesbsLoad(q, in, in + 16);
+		aesbsDecrypt(ap->nr, sk, q);
+		aesbsStore(q, out, out + 16);
+	}
+	if (nblocks)
+	{
+		aesbsLoad(q, in, in);
+		aesbsDecrypt(ap->nr, sk, q);
+		aesbsStore(q, out, spare);
+	}
+	return 0;
+}
+
+static int aesbsEncryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	uint32_t sk[120], q[8];
+	register const byte* in = (const byte*) src;
+	register byte* out = (byte*) dst;
+	register byte* iv = (byte*) ap->fdback;
+	byte x[16];
+
+	aesbsKeys(ap, sk);
+
+	for (; nblocks > 0; nblocks--, in += 16, out += 16)
+	{
+		xor16(x, in, iv);
+		aesbsLoad(q, x, x);
+		aesbsEncrypt(ap->nr, sk, q);
+		aesbsStore(q, iv, x);
+		memcpy(out, iv, 16);
+	}
+	return 0;
+}
+
+static int aesbsDecryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	uint32_t sk[120], q[8];
+	register const byte* in = (const byte*) src;
+	register byte* out = (byte*) dst;
+	register byte* iv = (byte*) ap->fdback;
+	byte c[32], p[32];
+
+	aesbsKeys(ap, sk);
+
+	/* the ciphertext is copied first, since out may be in */
+	for (; nblocks >= 2; nblocks -= 2, in += 32, out += 32)
+	{
+		memcpy(c, in, 32);
+		aesbsLoad(q, c, c + 16);
+		aesbsDecrypt(ap->nr, sk, q);
+		aesbsStore(q, p, p + 16);
+		xor16(out, p, iv);
+		xor16(out + 16, p + 16, c);
+		memcpy(iv, c + 16, 16);
+	}
+	if (nblocks)
+	{
+		memcpy(c, in, 16);
+		aesbsLoad(q, c, c);
+		aesbsDecrypt(ap->nr, sk, q);
+		aesbsStore(q, p, p + 16);
+		xor16(out, p, iv);
+		memcpy(iv, c, 16);
+	}
+	return 0;
+}
+
+static int aesbsCTR(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	uint32_t sk[120], q[8];
+	register const byte* in = (const byte*) src;
+	register byte* out = (byte*) dst;
+	register byte* ctr = (byte*) ap->fdback;
+	byte next[16], ks[32];
+
+	aesbsKeys(ap, sk);
+
+	for (; nblocks >= 2; nblocks -= 2, in += 32, out += 32)
+	{
+		memcpy(next, ctr, 16);
+		incr16(next);
+		aesbsLoad(q, ctr, next);
+		aesbsEncrypt(ap->nr, sk, q);
+		aesbsStore(q, ks, ks + 16);
+		xor16(out, in, ks);
+		xor16(out + 16, in + 16, ks + 16);
+		memcpy(ctr, next, 16);
+		incr16(ctr);
+	}
+	if (nblocks)
+	{
+		aesbsLoad(q, ctr, ctr);
+		aesbsEncrypt(ap->nr, sk, q);
+		aesbsStore(q, ks, ks + 16);
+		xor16(out, in, ks);
+		incr16(ctr);
+	}
+	return 0;
+}
+
+const aesModes aesModesBitsliced = {
+	"bitsliced",
+	aesbsEncryptECB,
+	aesbsDecryptECB,
+	aesbsEncryptCBC,
+	aesbsDecryptCBC,
+	aesbsCTR
+};
+
+/*!\}
+ */
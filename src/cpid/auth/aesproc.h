@@ -0,0 +1,51 @@
+/*!\file aesproc.h
+ * \brief The backends behind aesEncryptECB and the other multi-block AES
+ *  functions.
+ *
+ *  Each backend does all five modes: AES-NI if the CPU has it, else the
+ *  bitsliced C code, which is the only one there is on anything but x86.
+ *  Both run in time independent of the key and the data, unlike the
+ *  table-driven aesEncrypt and aesDecrypt, and both use the key schedule
+ *  aesSetup leaves in the parameter block as it is.
+ *
+ *  A constructor in aes.c makes the choice when the program is loaded,
+ *  before it can have started any threads, and it is only read after
+ *  that; until then the bitsliced code is used.
+ * \ingroup BC_aes_m
+ */
+
+#ifndef _AESPROC_H
+#define _AESPROC_H
+
+#include "beecrypt/aes.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+# define AES_X86 1
+#else
+# define AES_X86 0
+#endif
+
+typedef int (*aesModeFunction)(aesParam*, uint32_t*, const uint32_t*, unsigned int);
+
+typedef struct
+{
+	const char* name;
+	aesModeFunction encryptECB;
+	aesModeFunction decryptECB;
+	aesModeFunction encryptCBC;
+	aesModeFunction decryptCBC;
+	aesModeFunction ctr;
+} aesModes;
+
+/* in aesbs.c */
+extern const aesModes aesModesBitsliced;
+
+#if AES_X86
+/* in aesx86.c; only use this if aesx86Select hands it out */
+extern const aesModes aesModesNI;
+
+/* aesModesNI if the CPU can run it, or 0 */
+const aesModes* aesx86Select(void);
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+/*!\file aesx86.c
+ * \brief The multi-block AES modes with the AES-NI instructions.
+ *
+ *  AESENC takes several cycles to come back but a new one can start every
+ *  cycle or so, so ECB, CBC decryption and CTR keep eight independent
+ *  blocks in flight, one round of each after the other. CBC encryption is
+ *  one long chain and can't; it still gets the instructions. The round keys
+ *  are the ones aesSetup makes: its DECRYPT schedule is the reversed, mixed
+ *  one AESDEC wants.
+ *
+ *  The functions are compiled for AES-NI with a target attribute, as the
+ *  SHA-1 ones in sha1x86.c are, and aesx86Select checks CPUID first.
+ * \ingroup BC_aes_m
+ */
+
+#define BEECRYPT_DLL_EXPORT
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "aesproc.h"
+
+#if AES_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*!\addtogroup BC_aes_m
+ * \{
+ */
+
+#define AESNI_TARGET	__attribute__((target("aes,sse2")))
+
+#define AESNI_LANES	8
+
+#define LOAD(p)		_mm_loadu_si128((const __m128i*) (p))
+#define STORE(p, x)	_mm_storeu_si128((__m128i*) (p), x)
+
+AESNI_TARGET
+static void aesniKeys(const aesParam* ap, __m128i* rk)
+{
+	register uint32_t i;
+
+	for (i = 0; i <= ap->nr; i++)
+		rk[i] = LOAD(ap->k + 4*i);
+}
+
+AESNI_TARGET
+static __m128i aesniEncrypt1(uint32_t nr, const __m128i* rk, __m128i x)
+{
+	register uint32_t i;
+
+	x = _mm_xor_si128(x, rk[0]);
+	for (i = 1; i < nr; i++)
+		x = _mm_aesenc_si128(x, rk[i]);
+	return _mm_aesenclast_si128(x, rk[nr]);
+}
+
+AESNI_TARGET
+static __m128i aesniDecrypt1(uint32_t nr, const __m128i* rk, __m128i x)
+{
+	register uint32_t i;
+
+	x = _mm_xor_si128(x, rk[0]);
+	for (i = 1; i < nr; i++)
+		x = _mm_aesdec_si128(x, rk[i]);
+	return _mm_aesdeclast_si128(x, rk[nr]);
+}
+
+/* all AESNI_LANES blocks of x through the cipher, a round at a time */
+AESNI_TARGET
+static void aesniEncrypt8(uint32_t nr, const __m128i* rk, __m128i* x)
+{
+	register uint32_t i;
+	register int j;
+
+	for (j = 0; j < AESNI_LANES; j++)
+		x[j] = _mm_xor_si128(x[j], rk[0]);
+	for (i = 1; i < nr; i++)
+		for (j = 0; j < AESNI_LANES; j++)
+			x[j] = _mm_aesenc_si128(x[j], rk[i]);
+	for (j = 0; j < AESNI_LANES; j++)
+		x[j] = _mm_aesenclast_si128(x[j], rk[nr]);
+}
+
+AESNI_TARGET
+static void aesniDecrypt8(uint32_t nr, const __m128i* rk, __m128i* x)
+{
+	register uint32_t i;
+	register int j;
+
+	for (j = 0; j < AESNI_LANES; j++)
+		x[j] = _mm_xor_si128(x[j], rk[0]);
+	for (i = 1; i < nr; i++)
+		for (j = 0; j < AESNI_LANES; j++)
+			x[j] = _mm_aesdec_si128(x[j], rk[i]);
+	for (j = 0; j < AESNI_LANES; j++)
+		x[j] = _mm_aesdeclast_si128(x[j], rk[nr]);
+}
+
+AESNI_TARGET
+static int aesniEncryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	__m128i rk[15], x[AESNI_LANES];
+	register int j;
+
+	aesniKeys(ap, rk);
+
+	for (; nblocks >= AESNI_LANES; nblocks -= AESNI_LANES, src += 4*AESNI_LANES, dst += 4*AESNI_LANES)
+	{
+		for (j = 0; j < AESNI_LANES; j++)
+			x[j] = LOAD(src + 4*j);
+		aesniEncrypt8(ap->nr, rk, x);
+		for (j = 0; j < AESNI_LANES; j++)
+			STORE(dst + 4*j, x[j]);
+	}
+	for (; nblocks > 0; nblocks--, src += 4, dst += 4)
+		STORE(dst, aesniEncrypt1(ap->nr, rk, LOAD(src)));
+	return 0;
+}
+
+AESNI_TARGET
+static int aesniDecryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	__m128i rk[15], x[AESNI_LANES];
+	register int j;
+
+	aesniKeys(ap, rk);
+
+	for (; nblocks >= AESNI_LANES; nblocks -= AESNI_LANES, src += 4*AESNI_LANES, dst += 4*AESNI_LANES)
+	{
+		for (j = 0; j < AESNI_LANES; j++)
+			x[j] = LOAD(src + 4*j);
+		aesniDecrypt8(ap->nr, rk, x);
+		for (j = 0; j < AESNI_LANES; j++)
+			STORE(dst + 4*j, x[j]);
+	}
+	for (; nblocks > 0; nblocks--, src += 4, dst += 4)
+		STORE(dst, aesniDecrypt1(ap->nr, rk, LOAD(src)));
+	return 0;
+}
+
+AESNI_TARGET
+static int aesniEncryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	__m128i rk[15], iv;
+
+	aesniKeys(ap, rk);
+
+	iv = LOAD(ap->fdback);
+	for (; nblocks > 0; nblocks--, src += 4, dst += 4)
+	{
+		iv = aesniEncrypt1(ap->nr, rk, _mm_xor_si128(LOAD(src), iv));
+		STORE(dst, iv);
+	}
+	STORE(ap->fdback, iv);
+	return 0;
+}
+
+AESNI_TARGET
+static int aesniDecryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	__m128i rk[15], x[AESNI_LANES], c[AESNI_LANES], iv, next;
+	register int j;
+
+	aesniKeys(ap, rk);
+
+	/* every ciphertext block is loaded before any cleartext is stored,
+	 * since dst may be src */
+	iv = LOAD(ap->fdback);
+	for (; nblocks >= AESNI_LANES; nblocks -= AESNI_LANES, src += 4*AESNI_LANES, dst += 4*AESNI_LANES)
+	{
+		for (j = 0; j < AESNI_LANES; j++)
+			x[j] = c[j] = LOAD(src + 4*j);
+		aesniDecrypt8(ap->nr, rk, x);
+		STORE(dst, _mm_xor_si128(x[0], iv));
+		for (j = 1; j < AESNI_LANES; j++)
+			STORE(dst + 4*j, _mm_xor_si128(x[j], c[j-1]));
+		iv = c[AESNI_LANES-1];
+	}
+	for (; nblocks > 0; nblocks--, src += 4, dst += 4)
+	{
+		next = LOAD(src);
+		STORE(dst, _mm_xor_si128(aesniDecrypt1(ap->nr, rk, next), iv));
+		iv = next;
+	}
+	STORE(ap->fdback, iv);
+	return 0;
+}
+
+/*
+ * The counter block is big-endian, so it is kept as two host integers and
+ * byte-swapped into each block; hi and lo are its first and last 8 bytes.
+ */
+#define CTRBLOCK(hi, lo)	_mm_set_epi64x((long long) __builtin_bswap64(lo), (long long) __builtin_bswap64(hi))
+
+AESNI_TARGET
+static int aesniCTR(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+{
+	__m128i rk[15], x[AESNI_LANES];
+	uint64_t hi, lo;
+	byte* ctr = (byte*) ap->fdback;
+	register int i, j;
+
+	aesniKeys(ap, rk);
+
+	hi = lo = 0;
+	for (i = 0; i < 8; i++)
+	{
+		hi = (hi << 8) | ctr[i];
+		lo = (lo << 8) | ctr[i+8];
+	}
+
+	for (; nblocks >= AESNI_LANES; nblocks -= AESNI_LANES, src += 4*AESNI_LANES, dst += 4*AESNI_LANES)
+	{
+		for (j = 0; j < AESNI_LANES; j++)
+		{
+			x[j] = CTRBLOCK(hi, lo);
+			hi += (++lo == 0);
+		}
+		aesniEncrypt8(ap->nr, rk, x);
+		for (j = 0; j < AESNI_LANES; j++)
+			STORE(dst + 4*j, _mm_xor_si128(x[j], LOAD(src + 4*j)));
+	}
+	for (; nblocks > 0; nblocks--, src += 4, dst += 4)
+	{
+		STORE(dst, _mm_xor_si128(aesniEncrypt1(ap->nr, rk, CTRBLOCK(hi, lo)), LOAD(src)));
+		hi += (++lo == 0);
+	}
+
+	STORE(ctr, CTRBLOCK(hi, lo));
+	return 0;
+}
+
+const aesModes aesModesNI = {
+	"AES-NI",
+	aesniEncryptECB,
+	aesniDecryptECB,
+	aesniEncryptCBC,
+	aesniDecryptCBC,
+	aesniCTR
+};
+
+const aesModes* aesx86Select(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return (const aesModes*) 0;
+
+	if ((ecx & bit_AES) && (edx & bit_SSE2))
+		return &aesModesNI;
+	return (const aesModes*) 0;
+}
+
+/*!\}
+ */
+
+#endif
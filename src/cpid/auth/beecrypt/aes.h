@@ -110,6 +110,70 @@ int			aesEncrypt (aesParam* ap, uint32_t* dst, const uint32_t* src);
 BEECRYPTAPI
 int			aesDecrypt (aesParam* ap, uint32_t* dst, const uint32_t* src);
 
+/*!\fn int aesEncryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+ * \brief This function encrypts \a nblocks blocks, each on its own.
+ *
+ * This and the other multi-block functions below run in constant time: they
+ *  use AES-NI where the CPU has it and bitsliced C everywhere else, never
+ *  the lookup tables aesEncrypt and aesDecrypt use. \a dst may be \a src.
+ * \param ap The cipher's parameter block; set up for ENCRYPT.
+ * \param dst The ciphertext; should be aligned on 32-bit boundary.
+ * \param src The cleartext; should be aligned on 32-bit boundary.
+ * \param nblocks The number of blocks.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int			aesEncryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks);
+
+/*!\fn int aesDecryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+ * \brief This function decrypts \a nblocks blocks, each on its own.
+ * \param ap The cipher's parameter block; set up for DECRYPT.
+ * \param dst The cleartext; should be aligned on 32-bit boundary.
+ * \param src The ciphertext; should be aligned on 32-bit boundary.
+ * \param nblocks The number of blocks.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int			aesDecryptECB(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks);
+
+/*!\fn int aesEncryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+ * \brief This function encrypts \a nblocks blocks in CBC mode, chaining
+ *  from the feedback block (the IV, after aesSetIV) and leaving the last
+ *  ciphertext block there for the next call.
+ * \param ap The cipher's parameter block; set up for ENCRYPT.
+ * \param dst The ciphertext; should be aligned on 32-bit boundary.
+ * \param src The cleartext; should be aligned on 32-bit boundary.
+ * \param nblocks The number of blocks.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int			aesEncryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks);
+
+/*!\fn int aesDecryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+ * \brief This function decrypts \a nblocks blocks in CBC mode, chaining
+ *  the same way as aesEncryptCBC.
+ * \param ap The cipher's parameter block; set up for DECRYPT.
+ * \param dst The cleartext; should be aligned on 32-bit boundary.
+ * \param src The ciphertext; should be aligned on 32-bit boundary.
+ * \param nblocks The number of blocks.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int			aesDecryptCBC(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks);
+
+/*!\fn int aesCTR(aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks)
+ * \brief This function encrypts or decrypts \a nblocks blocks in counter
+ *  mode: each block is xored with the encryption of the feedback block,
+ *  which is then incremented as a 128-bit big-endian number.
+ * \param ap The cipher's parameter block; set up for ENCRYPT, either way.
+ * \param dst The output; should be aligned on 32-bit boundary.
+ * \param src The input; should be aligned on 32-bit boundary.
+ * \param nblocks The number of blocks.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int			aesCTR       (aesParam* ap, uint32_t* dst, const uint32_t* src, unsigned int nblocks);
+
 BEECRYPTAPI
 uint32_t*	aesFeedback(aesParam* ap);
 
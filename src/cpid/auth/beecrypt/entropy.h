@@ -49,6 +49,7 @@ int entropy_console(byte*, size_t);
 BEECRYPTAPI
 int entropy_wincrypt(byte*, size_t);
 #else
+int entropy_getrandom  (byte*, size_t);
 #if HAVE_DEV_AUDIO
 int entropy_dev_audio  (byte*, size_t);
 #endif
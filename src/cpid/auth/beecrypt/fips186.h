@@ -46,6 +46,23 @@
 # error
 #endif
 
+/*!\brief The number of 20-byte outputs made at a time.
+ * \ingroup PRNG_fips186_m
+ */
+#define FIPS186_BLOCKS			8
+
+/*!\brief The number of bytes a generator puts out between reseeds.
+ * \ingroup PRNG_fips186_m
+ */
+#define FIPS186_RESEED_BYTES	65536
+
+/*!\brief Put in reseedremain for a generator that never reseeds, so that
+ *  its output follows from its seed alone, as for reproducible tests.
+ *  Generators forked from it don't reseed either.
+ * \ingroup PRNG_fips186_m
+ */
+#define FIPS186_NO_RESEED		((size_t) -1)
+
 /*!\ingroup PRNG_fips186_m
  */
 #ifdef __cplusplus
@@ -59,8 +76,20 @@ struct _fips186Param
 	#endif
 	sha1Param		param;
 	mpw			state[FIPS186_STATE_SIZE];
-	byte			digest[20];
-	unsigned char	digestremain;
+	/*!\var digest
+	 * \brief Output made ahead; the last \a digestremain bytes are unused.
+	 */
+	byte			digest[20 * FIPS186_BLOCKS];
+	size_t			digestremain;
+	/*!\var reseedremain
+	 * \brief Bytes to put out before the state takes in fresh entropy.
+	 */
+	size_t			reseedremain;
+	/*!\var forked
+	 * \brief Set for a per-thread generator made by fips186Fork, which
+	 *  has no lock.
+	 */
+	int				forked;
 };
 
 #ifndef __cplusplus
@@ -83,6 +112,38 @@ int fips186Next   (fips186Param*, byte*, size_t);
 BEECRYPTAPI
 int fips186Cleanup(fips186Param*);
 
+/*!\fn int fips186SeedHex(fips186Param* fp, const char* hex)
+ * \brief This function replaces the state of \a fp with a fixed seed
+ *  and stops it reseeding, so that it gives the same output every run.
+ *
+ * For tests and reproducible tool runs only; nothing it generates is
+ *  secret from anyone who knows \a hex.
+ * \param fp The generator.
+ * \param hex The seed: 2 to 128 hex digits, an even number of them.
+ * \retval 0 on success.
+ * \retval -1 on failure, or if \a hex isn't a seed.
+ */
+BEECRYPTAPI
+int fips186SeedHex(fips186Param* fp, const char* hex);
+
+/*!\fn int fips186Fork(fips186Param* fp, fips186Param* from)
+ * \brief This function sets up \a fp as a generator for one thread,
+ *  seeded from the output of \a from.
+ *
+ * Each thread that wants random numbers in bulk can have its own, and
+ *  then no thread ever waits for another: a forked generator has no lock,
+ *  and reseeds itself from entropyGatherNext, not from \a from, which only
+ *  needs to last until this returns. Don't share one between threads.
+ *  Pass it to fips186Next and fips186Cleanup as usual, or use it as the
+ *  param of a randomGeneratorContext with fips186prng.
+ * \param fp The new generator.
+ * \param from The generator to seed it from; locked while it is read.
+ * \retval 0 on success.
+ * \retval -1 on failure.
+ */
+BEECRYPTAPI
+int fips186Fork   (fips186Param* fp, fips186Param* from);
+
 #ifdef __cplusplus
 }
 #endif
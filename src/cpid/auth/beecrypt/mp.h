@@ -535,6 +535,20 @@ int mpsub (size_t size, mpw* xdata, const mpw* ydata);
 BEECRYPTAPI
 int mpsubx(size_t xsize, mpw* xdata, size_t ysize, const mpw* ydata);
 
+/*!\fn int mpcsubx(size_t xsize, mpw* xdata, size_t ysize, const mpw* ydata)
+ * \brief This function subtracts ydata from xdata if xdata >= ydata, in
+ *  time that depends only on the sizes. The performed operation in
+ *  pseudocode: if (x >= y) x -= y.
+ * \param xsize The size of the first multi-precision integer; not less
+ *  than ysize.
+ * \param xdata The first multi-precision integer.
+ * \param ysize The size of the second multi-precision integer.
+ * \param ydata The second multi-precision integer.
+ * \return 1 if y was subtracted, 0 if not.
+ */
+BEECRYPTAPI
+int mpcsubx(size_t xsize, mpw* xdata, size_t ysize, const mpw* ydata);
+
 BEECRYPTAPI
 int mpmultwo(size_t size, mpw* data);
 
@@ -640,12 +654,53 @@ void mpmul(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const mpw*
 BEECRYPTAPI
 void mpsqr(mpw* result, size_t size, const mpw* data);
 
+/*!\fn void mpcombamul(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const mpw* ydata)
+ * \brief This function computes the same product as mpmul, one result
+ *  word at a time (Comba's method), so each word of the result is written
+ *  once instead of once per row.
+ */
+BEECRYPTAPI
+void mpcombamul(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const mpw* ydata);
+
+/*!\fn void mpcombasqr(mpw* result, size_t size, const mpw* data)
+ * \brief This function computes the same square as mpsqr in a single
+ *  column-wise pass, forming the doubled cross products and the diagonal
+ *  together instead of in three passes over the result.
+ */
+BEECRYPTAPI
+void mpcombasqr(mpw* result, size_t size, const mpw* data);
+
+/*!\fn int mpfixmul(mpw* result, size_t size, const mpw* xdata, const mpw* ydata)
+ * \brief This function computes the product of two size-word numbers with
+ *  a kernel compiled for that size (512, 1024 or 2048 bits).
+ * \retval 0 on success, -1 if there is no kernel for size.
+ */
+BEECRYPTAPI
+int mpfixmul(mpw* result, size_t size, const mpw* xdata, const mpw* ydata);
+
+/*!\fn int mpfixsqr(mpw* result, size_t size, const mpw* data)
+ * \brief This function computes the square of a size-word number with a
+ *  kernel compiled for that size (512, 1024 or 2048 bits).
+ * \retval 0 on success, -1 if there is no kernel for size.
+ */
+BEECRYPTAPI
+int mpfixsqr(mpw* result, size_t size, const mpw* data);
+
 BEECRYPTAPI
 void mpgcd_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw* wksp);
 
 BEECRYPTAPI
 int  mpextgcd_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw* wksp);
 
+/*!\fn int mpoddinv_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw* wksp)
+ * \brief This function computes the inverse of ydata modulo an odd xdata,
+ *  like mpextgcd_w but faster; ydata must be less than xdata.
+ * \param wksp Workspace of (4*size+4) words.
+ * \retval 1 if the inverse exists, 0 if not.
+ */
+BEECRYPTAPI
+int  mpoddinv_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw* wksp);
+
 BEECRYPTAPI
 mpw mppndiv(mpw xhi, mpw xlo, mpw y);
 
@@ -100,11 +100,19 @@ void mpbrndodd_w(const mpbarrett*, randomGeneratorContext*, mpw*, mpw*);
 BEECRYPTAPI
 void mpbrndinv_w(const mpbarrett*, randomGeneratorContext*, mpw*, mpw*, mpw*);
 
+/* inverts count numbers modulo an odd b at once; 0 if any of them has no inverse */
+BEECRYPTAPI
+int mpbinvbatch_w(const mpbarrett*, size_t, mpw*, mpw*);
+
 BEECRYPTAPI
 void mpbneg_w(const mpbarrett*, const mpw*, mpw*);
 BEECRYPTAPI
 void mpbmod_w(const mpbarrett*, const mpw*, mpw*, mpw*);
 
+/* as mpbmod_w, for a modulus of 512, 1024 or 2048 bits; -1 for other sizes */
+BEECRYPTAPI
+int mpfixbmod_w(const mpbarrett*, const mpw*, mpw*, mpw*);
+
 BEECRYPTAPI
 void mpbaddmod_w(const mpbarrett*, size_t, const mpw*, size_t, const mpw*, mpw*, mpw*);
 BEECRYPTAPI
@@ -46,6 +46,8 @@ int  mpprnd_w      (mpbarrett*, randomGeneratorContext*, size_t, int, const mpnu
 BEECRYPTAPI
 int  mpprndr_w     (mpbarrett*, randomGeneratorContext*, size_t, int, const mpnumber*, const mpnumber*, const mpnumber*, mpw*);
 BEECRYPTAPI
+int  mpprndtry_w   (mpbarrett*, randomGeneratorContext*, size_t, int, const mpnumber*, const mpnumber*, const mpnumber*, mpw*);
+BEECRYPTAPI
 void mpprndsafe_w  (mpbarrett*, randomGeneratorContext*, size_t, int, mpw*);
 BEECRYPTAPI
 void mpprndcon_w   (mpbarrett*, randomGeneratorContext*, size_t, int, const mpnumber*, const mpnumber*, const mpnumber*, mpnumber*, mpw*);
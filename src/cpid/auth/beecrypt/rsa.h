@@ -97,6 +97,35 @@ int rsapricrt(const mpbarrett* n, const mpbarrett* p, const mpbarrett* q,
               const mpnumber* dp, const mpnumber* dq, const mpnumber* qi,
               const mpnumber* c, mpnumber* m);
 
+/*!\brief The largest modulus rsapricrtblind takes, in bits; it unblinds
+ *  in a workspace of this size on the stack.
+ * \ingroup IF_rsa_m
+ */
+#define RSA_BLIND_MAXBITS	2048
+
+/*!\fn int rsapricrtblind(const rsakp* kp, const mpnumber* rm, const mpnumber* rb, const mpnumber* m, mpnumber* s)
+ * \brief This function performs a blinded RSA private key operation
+ *  with the Chinese Remainder Theorem.
+ *
+ * It computes \f$s=rm \cdot m^{d}\ \textrm{mod}\ n\f$ by signing
+ * \f$(rm \cdot rb)^{e} \cdot m\f$ and dividing the result by \a rb, so the
+ * exponentiation never sees \a m itself. \a rm is left in the result;
+ * \a rb is not. The raw result is checked against the public key before
+ * it is unblinded.
+ *
+ * \param kp The RSA keypair.
+ * \param rm The blinding factor left in the result.
+ * \param rb The blinding factor taken out again; less than n.
+ * \param m The message.
+ * \param s The blinded signature.
+ * \retval 0 on success.
+ * \retval -1 on failure, including a result that fails the check, or
+ *  an \a n of more than RSA_BLIND_MAXBITS bits.
+ */
+BEECRYPTAPI
+int rsapricrtblind(const rsakp* kp, const mpnumber* rm, const mpnumber* rb,
+                   const mpnumber* m, mpnumber* s);
+
 /*!\fn int rsavrfy(const mpbarrett* n, const mpnumber* e, const mpnumber* m, const mpnumber* c)
  * \brief This function performs a raw RSA verification.
  *
@@ -85,12 +85,30 @@ struct _rsakp
 typedef struct _rsakp rsakp;
 #endif
 
+/*!\brief A prime search with the parameters of mpprndr_w, which is the
+ *  one rsakpMake uses.
+ * \ingroup IF_rsa_m
+ */
+typedef int (*rsakpPrimeFunction)(mpbarrett*, randomGeneratorContext*, size_t, int, const mpnumber*, const mpnumber*, const mpnumber*, mpw*);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 BEECRYPTAPI
 int rsakpMake(rsakp*, randomGeneratorContext*, size_t);
+/*!\fn int rsakpMakeWith(rsakp* kp, randomGeneratorContext* rgc, size_t bits, rsakpPrimeFunction prnd)
+ * \brief As rsakpMake, but finds p and q with \a prnd.
+ *
+ * The search has to make the same checks mpprndr_w does; this lets it
+ *  make them on several threads at once.
+ * \param prnd Called for p, then for q with the minimum that makes n
+ *  \a bits long.
+ * \retval 0 on success.
+ * \retval -1 on failure.
+ */
+BEECRYPTAPI
+int rsakpMakeWith(rsakp*, randomGeneratorContext*, size_t, rsakpPrimeFunction);
 BEECRYPTAPI
 int rsakpInit(rsakp*);
 BEECRYPTAPI
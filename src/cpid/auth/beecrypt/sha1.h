@@ -66,6 +66,24 @@ struct _sha1Param
 typedef struct _sha1Param sha1Param;
 #endif
 
+/*!\brief One of a batch of independent messages for sha1Multi.
+ * \ingroup HASH_sha1_m
+ */
+typedef struct
+{
+	/*!\var data
+	 */
+	const byte* data;
+	/*!\var size
+	 * \brief Length of \a data in bytes.
+	 */
+	size_t size;
+	/*!\var digest
+	 * \brief Where the 20-byte digest goes.
+	 */
+	byte* digest;
+} sha1Message;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -113,6 +131,18 @@ int  sha1Update (sha1Param* sp, const byte* data, size_t size);
 BEECRYPTAPI
 int  sha1Digest (sha1Param* sp, byte* digest);
 
+/*!\fn int sha1Multi(size_t count, const sha1Message* msg)
+ * \brief This function hashes \a count independent messages in one call,
+ *  running several of them side by side in SIMD lanes on CPUs where
+ *  that is quicker than one at a time; each digest is the same as a sha1Reset, sha1Update, sha1Digest
+ *  of that message alone.
+ * \param count The number of messages.
+ * \param msg The messages.
+ * \retval 0 on success.
+ */
+BEECRYPTAPI
+int  sha1Multi  (size_t count, const sha1Message* msg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,7 +20,7 @@
 /* #define ENABLE_THREADS 1 */
 
 /* Define to 1 if you want to enable thread-local-storage support */
-/* #define ENABLE_THREAD_LOCAL_STORAGE 0 */
+#define ENABLE_THREAD_LOCAL_STORAGE 1
 
 /* Define to 1 if you are using FreeBSD */
 /* #undef FREEBSD */
@@ -7,6 +7,10 @@
 #include "beecrypt/fips186.h"
 # include <fcntl.h>
 #include <errno.h>
+#if LINUX || defined(__linux__)
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
 
 /*!\addtogroup ES_urandom_m
  * \{
@@ -60,10 +64,112 @@ static int opendevice(const char *device)
 }
 
 
+/*!\addtogroup ES_getrandom_m
+ * \{
+ */
+#ifdef SYS_getrandom
+# define GETRANDOM_POOL_SIZE	256
+
+# if ENABLE_THREAD_LOCAL_STORAGE
+/*
+ * Each thread draws from a pool of its own, so handing out bytes and
+ * refilling take no lock at all. Bytes are wiped from the pool as they go
+ * out, and the pool remembers which process filled it, so that a child of
+ * fork() doesn't hand out the same bytes as its parent.
+ */
+static __thread byte getrandom_pool[GETRANDOM_POOL_SIZE];
+static __thread size_t getrandom_avail = 0;
+static __thread pid_t getrandom_pid = 0;
+# endif
+
+/* set once the kernel turns out to predate getrandom(2) */
+static int getrandom_missing = 0;
+
+static int getrandom_fill(byte* data, size_t size)
+{
+	register long rc;
+
+	while (size > 0)
+	{
+		rc = syscall(SYS_getrandom, data, size, 0);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS)
+				getrandom_missing = 1;
+			return -1;
+		}
+		data += rc;
+		size -= rc;
+	}
+	return 0;
+}
+#endif
+/*!\}
+ */
+
+/*
+ * The kernel's urandom pool through getrandom(2): no device to stat, open
+ * and close, and it blocks only until the kernel pool has been seeded
+ * once, after which it never does. Small requests are served from a
+ * per-thread buffer, refilled 256 bytes at a time; without thread-local
+ * storage, every request goes to the kernel. Fails, so entropyGatherNext
+ * moves on to /dev/urandom, on a kernel without the system call.
+ */
+int entropy_getrandom(byte* data, size_t size)
+{
+	#ifdef SYS_getrandom
+	# if ENABLE_THREAD_LOCAL_STORAGE
+	register size_t n;
+	register pid_t pid;
+	# endif
+
+	if (getrandom_missing)
+		return -1;
+
+	# if ENABLE_THREAD_LOCAL_STORAGE
+	pid = getpid();
+	if (getrandom_pid != pid)
+	{
+		memset(getrandom_pool, 0, sizeof(getrandom_pool));
+		getrandom_avail = 0;
+		getrandom_pid = pid;
+	}
+
+	while (size > 0)
+	{
+		if (getrandom_avail == 0)
+		{
+			/* big requests needn't go through the pool */
+			if (size >= GETRANDOM_POOL_SIZE)
+				return getrandom_fill(data, size);
+			if (getrandom_fill(getrandom_pool, GETRANDOM_POOL_SIZE))
+				return -1;
+			getrandom_avail = GETRANDOM_POOL_SIZE;
+		}
+
+		n = (size < getrandom_avail) ? size : getrandom_avail;
+		getrandom_avail -= n;
+		memcpy(data, getrandom_pool + getrandom_avail, n);
+		memset(getrandom_pool + getrandom_avail, 0, n);
+		data += n;
+		size -= n;
+	}
+	return 0;
+	# else
+	return getrandom_fill(data, size);
+	# endif
+	#else
+	return -1;
+	#endif
+}
+
 int entropy_dev_urandom(byte* data, size_t size);
 
 static entropySource entropySourceList[] =
 {
+	{ "getrandom", entropy_getrandom },
 	{ "urandom", entropy_dev_urandom },
 };
 
@@ -52,6 +52,151 @@ static int fips186init(register sha1Param* p)
 	return 0;
 }
 
+/* the lock, unless fp is a forked generator, which has none */
+static int fips186lock(fips186Param* fp)
+{
+	#ifdef _REENTRANT
+	if (fp->forked)
+		return 0;
+	# if WIN32
+	if (WaitForSingleObject(fp->lock, INFINITE) != WAIT_OBJECT_0)
+		return -1;
+	# else
+	#  if HAVE_THREAD_H && HAVE_SYNCH_H
+	if (mutex_lock(&fp->lock))
+		return -1;
+	#  elif HAVE_PTHREAD_H
+	if (pthread_mutex_lock(&fp->lock))
+		return -1;
+	#  endif
+	# endif
+	#endif
+	return 0;
+}
+
+static int fips186unlock(fips186Param* fp)
+{
+	#ifdef _REENTRANT
+	if (fp->forked)
+		return 0;
+	# if WIN32
+	if (!ReleaseMutex(fp->lock))
+		return -1;
+	# else
+	#  if HAVE_THREAD_H && HAVE_SYNCH_H
+	if (mutex_unlock(&fp->lock))
+		return -1;
+	#  elif HAVE_PTHREAD_H
+	if (pthread_mutex_unlock(&fp->lock))
+		return -1;
+	#  endif
+	# endif
+	#endif
+	return 0;
+}
+
+/* adds up to 64 bytes of data, as a big-endian integer, to the state */
+static void fips186add(fips186Param* fp, const byte* data, size_t size)
+{
+	mpw seed[FIPS186_STATE_SIZE];
+
+	/* if there's too much data, cut off at what we can deal with */
+	if (size > MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE))
+		size = MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE);
+
+	/* convert to multi-precision integer, and add to the state */
+	if (os2ip(seed, FIPS186_STATE_SIZE, data, size) == 0)
+		mpadd(FIPS186_STATE_SIZE, fp->state, seed);
+
+	memset(seed, 0, sizeof(seed));
+}
+
+/*
+ * Makes FIPS186_BLOCKS outputs into fp->digest. Each one is the SHA-1 of
+ * the state, which then becomes state + digest + 1, so they can only be
+ * made one after the other; what doing several at once saves is taking
+ * the lock and coming through here for every 20 bytes.
+ */
+static void fips186fill(fips186Param* fp)
+{
+	register byte* digest = fp->digest;
+	register int i;
+
+	/* every FIPS186_RESEED_BYTES, stir in fresh entropy; if there is none
+	 * to be had just now, go on and try again next time */
+	if (fp->reseedremain == 0)
+	{
+		byte fresh[MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE)];
+
+		if (entropyGatherNext(fresh, sizeof(fresh)) == 0)
+		{
+			fips186add(fp, fresh, sizeof(fresh));
+			fp->reseedremain = FIPS186_RESEED_BYTES;
+		}
+		memset(fresh, 0, sizeof(fresh));
+	}
+
+	for (i = 0; i < FIPS186_BLOCKS; i++, digest += 20)
+	{
+		fips186init(&fp->param);
+		/* copy the 512 bits of state data into the sha1Param */
+		memcpy(fp->param.data, fp->state, MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE));
+		/* process the data */
+		sha1Process(&fp->param);
+
+		#if WORDS_BIGENDIAN
+		memcpy(digest, fp->param.h, 20);
+		#else
+		/* encode 5 integers big-endian style */
+		digest[ 0] = (byte)(fp->param.h[0] >> 24);
+		digest[ 1] = (byte)(fp->param.h[0] >> 16);
+		digest[ 2] = (byte)(fp->param.h[0] >>  8);
+		digest[ 3] = (byte)(fp->param.h[0] >>  0);
+		digest[ 4] = (byte)(fp->param.h[1] >> 24);
+		digest[ 5] = (byte)(fp->param.h[1] >> 16);
+		digest[ 6] = (byte)(fp->param.h[1] >>  8);
+		digest[ 7] = (byte)(fp->param.h[1] >>  0);
+		digest[ 8] = (byte)(fp->param.h[2] >> 24);
+		digest[ 9] = (byte)(fp->param.h[2] >> 16);
+		digest[10] = (byte)(fp->param.h[2] >>  8);
+		digest[11] = (byte)(fp->param.h[2] >>  0);
+		digest[12] = (byte)(fp->param.h[3] >> 24);
+		digest[13] = (byte)(fp->param.h[3] >> 16);
+		digest[14] = (byte)(fp->param.h[3] >>  8);
+		digest[15] = (byte)(fp->param.h[3] >>  0);
+		digest[16] = (byte)(fp->param.h[4] >> 24);
+		digest[17] = (byte)(fp->param.h[4] >> 16);
+		digest[18] = (byte)(fp->param.h[4] >>  8);
+		digest[19] = (byte)(fp->param.h[4] >>  0);
+		#endif
+
+		/* set state to state + digest + 1 mod 2^512 */
+		#if (MP_WBITS == 32)
+		/* the hash words are already the digest's mpw, most significant first */
+		mpaddx(FIPS186_STATE_SIZE, fp->state, 5, fp->param.h);
+		mpaddw(FIPS186_STATE_SIZE, fp->state, 1);
+		#else
+		{
+			mpw dig[FIPS186_STATE_SIZE];
+
+			if (os2ip(dig, FIPS186_STATE_SIZE, digest, 20) == 0)
+			{
+				mpadd (FIPS186_STATE_SIZE, fp->state, dig);
+				mpaddw(FIPS186_STATE_SIZE, fp->state, 1);
+			}
+			/* else shouldn't occur */
+		}
+		#endif
+	}
+	/* the hash's last words are one step of the state; don't leave them */
+	memset(fp->param.h, 0, sizeof(fp->param.h));
+	memset(fp->param.data, 0, sizeof(fp->param.data));
+
+	fp->digestremain = sizeof(fp->digest);
+	if (fp->reseedremain != FIPS186_NO_RESEED)
+		fp->reseedremain = (fp->reseedremain > sizeof(fp->digest)) ? fp->reseedremain - sizeof(fp->digest) : 0;
+}
+
 int fips186Setup(fips186Param* fp)
 {
 	if (fp)
@@ -72,56 +217,102 @@ int fips186Setup(fips186Param* fp)
 		#endif
 
 		fp->digestremain = 0;
+		fp->reseedremain = FIPS186_RESEED_BYTES;
+		fp->forked = 0;
 
 		return entropyGatherNext((byte*) fp->state, MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE));
 	}
 	return -1;
 }
 
+int fips186Fork(fips186Param* fp, fips186Param* from)
+{
+	if (fp && from)
+	{
+		byte seed[MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE)];
+		int rc;
+
+		memset(fp, 0, sizeof(*fp));
+		fp->forked = 1;
+
+		/* from takes its own lock here, if it has one */
+		rc = fips186Next(from, seed, sizeof(seed));
+		if (rc == 0)
+			rc = os2ip(fp->state, FIPS186_STATE_SIZE, seed, sizeof(seed));
+
+		fp->digestremain = 0;
+		fp->reseedremain = (from->reseedremain == FIPS186_NO_RESEED) ? FIPS186_NO_RESEED : FIPS186_RESEED_BYTES;
+
+		memset(seed, 0, sizeof(seed));
+		return rc;
+	}
+	return -1;
+}
+
 int fips186Seed(fips186Param* fp, const byte* data, size_t size)
 {
 	if (fp)
 	{
-		#ifdef _REENTRANT
-		# if WIN32
-		if (WaitForSingleObject(fp->lock, INFINITE) != WAIT_OBJECT_0)
+		if (fips186lock(fp))
 			return -1;
-		# else
-		#  if HAVE_THREAD_H && HAVE_SYNCH_H
-		if (mutex_lock(&fp->lock))
-			return -1;
-		#  elif HAVE_PTHREAD_H
-		if (pthread_mutex_lock(&fp->lock))
-			return -1;
-		#  endif
-		# endif
-		#endif
 		if (data)
 		{
-			mpw seed[FIPS186_STATE_SIZE];
+			fips186add(fp, data, size);
+			/* output made ahead came from the old state; the seed
+			 * must show in the very next block */
+			memset(fp->digest, 0, sizeof(fp->digest));
+			fp->digestremain = 0;
+		}
+		if (fips186unlock(fp))
+			return -1;
+		return 0;
+	}
+	return -1;
+}
 
-			/* if there's too much data, cut off at what we can deal with */
-			if (size > MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE))
-				size = MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE);
+int fips186SeedHex(fips186Param* fp, const char* hex)
+{
+	if (fp && hex)
+	{
+		byte seed[64];
+		register size_t size = 0, i;
+		register int nibble;
+		register char ch;
 
-			/* convert to multi-precision integer, and add to the state */
-			if (os2ip(seed, FIPS186_STATE_SIZE, data, size) == 0)
-				mpadd(FIPS186_STATE_SIZE, fp->state, seed);
+		for (i = 0; hex[i] != '\0'; i++)
+		{
+			ch = hex[i];
+			if (ch >= '0' && ch <= '9')
+				nibble = ch - '0';
+			else if (ch >= 'A' && ch <= 'F')
+				nibble = ch - 'A' + 10;
+			else if (ch >= 'a' && ch <= 'f')
+				nibble = ch - 'a' + 10;
+			else
+				break;
+			if (size == sizeof(seed))
+				break;
+			if (i & 1)
+				seed[size++] |= (byte) nibble;
+			else
+				seed[size] = (byte) (nibble << 4);
 		}
-		#ifdef _REENTRANT
-		# if WIN32
-		if (!ReleaseMutex(fp->lock))
+		if (hex[i] != '\0' || (i & 1) || size == 0)
+		{
+			memset(seed, 0, sizeof(seed));
 			return -1;
-		# else
-		#  if HAVE_THREAD_H && HAVE_SYNCH_H
-		if (mutex_unlock(&fp->lock))
+		}
+
+		if (fips186lock(fp))
 			return -1;
-		#  elif HAVE_PTHREAD_H
-		if (pthread_mutex_unlock(&fp->lock))
+		memset(fp->state, 0, sizeof(fp->state));
+		memset(fp->digest, 0, sizeof(fp->digest));
+		fp->digestremain = 0;
+		fp->reseedremain = FIPS186_NO_RESEED;
+		fips186add(fp, seed, size);
+		memset(seed, 0, sizeof(seed));
+		if (fips186unlock(fp))
 			return -1;
-		#  endif
-		# endif
-		#endif
 		return 0;
 	}
 	return -1;
@@ -131,91 +322,29 @@ int fips186Next(fips186Param* fp, byte* data, size_t size)
 {
 	if (fp)
 	{
-		mpw dig[FIPS186_STATE_SIZE];
-
-		#ifdef _REENTRANT
-		# if WIN32
-		if (WaitForSingleObject(fp->lock, INFINITE) != WAIT_OBJECT_0)
+		if (fips186lock(fp))
 			return -1;
-		# else
-		#  if HAVE_THREAD_H && HAVE_SYNCH_H
-		if (mutex_lock(&fp->lock))
-			return -1;
-		#  elif HAVE_PTHREAD_H
-		if (pthread_mutex_lock(&fp->lock))
-			return -1;
-		#  endif
-		# endif
-		#endif
 
 		while (size > 0)
 		{
 			register size_t copy;
+			register byte* from;
 
 			if (fp->digestremain == 0)
-			{
-				fips186init(&fp->param);
-				/* copy the 512 bits of state data into the sha1Param */
-				memcpy(fp->param.data, fp->state, MP_WORDS_TO_BYTES(FIPS186_STATE_SIZE));
-				/* process the data */
-				sha1Process(&fp->param);
-				
-				#if WORDS_BIGENDIAN
-				memcpy(fp->digest, fp->param.h, 20);
-				#else
-				/* encode 5 integers big-endian style */
-				fp->digest[ 0] = (byte)(fp->param.h[0] >> 24);
-				fp->digest[ 1] = (byte)(fp->param.h[0] >> 16);
-				fp->digest[ 2] = (byte)(fp->param.h[0] >>  8);
-				fp->digest[ 3] = (byte)(fp->param.h[0] >>  0);
-				fp->digest[ 4] = (byte)(fp->param.h[1] >> 24);
-				fp->digest[ 5] = (byte)(fp->param.h[1] >> 16);
-				fp->digest[ 6] = (byte)(fp->param.h[1] >>  8);
-				fp->digest[ 7] = (byte)(fp->param.h[1] >>  0);
-				fp->digest[ 8] = (byte)(fp->param.h[2] >> 24);
-				fp->digest[ 9] = (byte)(fp->param.h[2] >> 16);
-				fp->digest[10] = (byte)(fp->param.h[2] >>  8);
-				fp->digest[11] = (byte)(fp->param.h[2] >>  0);
-				fp->digest[12] = (byte)(fp->param.h[3] >> 24);
-				fp->digest[13] = (byte)(fp->param.h[3] >> 16);
-				fp->digest[14] = (byte)(fp->param.h[3] >>  8);
-				fp->digest[15] = (byte)(fp->param.h[3] >>  0);
-				fp->digest[16] = (byte)(fp->param.h[4] >> 24);
-				fp->digest[17] = (byte)(fp->param.h[4] >> 16);
-				fp->digest[18] = (byte)(fp->param.h[4] >>  8);
-				fp->digest[19] = (byte)(fp->param.h[4] >>  0);
-				#endif
-
-				if (os2ip(dig, FIPS186_STATE_SIZE, fp->digest, 20) == 0)
-				{
-					/* set state to state + digest + 1 mod 2^512 */
-					mpadd (FIPS186_STATE_SIZE, fp->state, dig);
-					mpaddw(FIPS186_STATE_SIZE, fp->state, 1);
-				}
-				/* else shouldn't occur */
-				/* we now have 5 words of pseudo-random data */
-				fp->digestremain = 20;
-			}
+				fips186fill(fp);
+
 			copy = (size > fp->digestremain) ? fp->digestremain : size;
-			memcpy(data, fp->digest+20-fp->digestremain, copy);
+			from = fp->digest + sizeof(fp->digest) - fp->digestremain;
+			memcpy(data, from, copy);
+			/* output once handed out is nobody else's */
+			memset(from, 0, copy);
 			fp->digestremain -= copy;
 			size -= copy;
 			data += copy;
 		}
-		#ifdef _REENTRANT
-		# if WIN32
-		if (!ReleaseMutex(fp->lock))
-			return -1;
-		# else
-		#  if HAVE_THREAD_H && HAVE_SYNCH_H
-		if (mutex_unlock(&fp->lock))
-			return -1;
-		#  elif HAVE_PTHREAD_H
-		if (pthread_mutex_unlock(&fp->lock))
+
+		if (fips186unlock(fp))
 			return -1;
-		#  endif
-		# endif
-		#endif
 		return 0;
 	}
 	return -1;
@@ -226,19 +355,25 @@ int fips186Cleanup(fips186Param* fp)
 	if (fp)
 	{
 		#ifdef _REENTRANT
+		if (!fp->forked)
+		{
 		# if WIN32
-		if (!CloseHandle(fp->lock))
-			return -1;
+			if (!CloseHandle(fp->lock))
+				return -1;
 		# else
 		#  if HAVE_THREAD_H && HAVE_SYNCH_H
-		if (mutex_destroy(&fp->lock))
-			return -1;
+			if (mutex_destroy(&fp->lock))
+				return -1;
 		#  elif HAVE_PTHREAD_H
-		if (pthread_mutex_destroy(&fp->lock))
-			return -1;
+			if (pthread_mutex_destroy(&fp->lock))
+				return -1;
 		#  endif
 		# endif
+		}
 		#endif
+		memset(fp->state, 0, sizeof(fp->state));
+		memset(fp->digest, 0, sizeof(fp->digest));
+		fp->digestremain = 0;
 		return 0;
 	}
 	return -1;
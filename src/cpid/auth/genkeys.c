@@ -2,35 +2,167 @@
 // bunnie@chumby.com
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "beecrypt/sha1.h"
 #include "beecrypt/aes.h"
 #include <string.h>
 #include "beecrypt/rsa.h"
+#include "beecrypt/rsakp.h"
+#include "beecrypt/mpprime.h"
 #include "beecrypt/fips186.h"
 #include "beecrypt/entropy.h"
 
 #include "chumbyCrypt.h"
+#include "toHex.h"
 
+#define RACE_THREADS_MAX 16
 
-char hexToAscii(char c) {
-  return(c < 0xA ? c + '0' : c + 'A' - 0xA);
-}
+/***
+    Finding p and q is nearly all of the time genkeys takes, and a search
+    is a run of independent tries -- draw a candidate, test it -- so it
+    races the tries for each prime across threads.
+
+    Try k gets its own generator, forked from one the race forks from the
+    main generator up front, and forks are handed out strictly in order of
+    k.  The prime kept is the one from the lowest k that found one, and no
+    try below that is abandoned, so which prime that is depends only on the
+    main generator and not on the thread count or the timing; and the main
+    generator gives up exactly one fork per prime.  With -s the keys are
+    thus the same every run, on any machine.  (They are not the ones the
+    single-stream rsakpMake would give for the same seed.)
+
+    Each try is mpprndtry_w, the loop body of beecrypt's own mpprndr_w, so
+    the candidates pass the same small-prime, gcd(p-1,e) and Miller-Rabin
+    checks, with the same number of rounds.
+***/
+
+static int raceThreads = 1;
 
-int toHex(byte *digest, char *digestHex, int numBytes) {
-  int i = 0;
+struct primeRace {
+  pthread_mutex_t lock;
+  fips186Param root;       // forks one generator per try; under lock
+  unsigned long next;      // the next try to hand out
+  unsigned long won;       // the lowest try that found a prime so far
+  int found, failed;
+  mpbarrett *p;            // the winning prime goes here
+  // mpprndr_w's parameters
+  size_t bits;
+  int t;
+  const mpnumber *min, *max, *f;
+};
 
-  // assume MSB first for digest
-  for( i = 0; i < numBytes; i++ ) {
-    digestHex[2*i] = hexToAscii((digest[i] & 0xF0) >> 4);
-    digestHex[2*i + 1] = hexToAscii((digest[i] & 0xF));
+static void *raceRun(void *arg) {
+  struct primeRace *race = (struct primeRace *) arg;
+  size_t size = MP_BITS_TO_WORDS(race->bits + MP_WBITS - 1);
+  fips186Param fork;
+  randomGeneratorContext rc;
+  mpbarrett cand;
+  mpw *wksp;
+  unsigned long k;
+  int res;
+
+  wksp = (mpw *) malloc((8*size+2) * sizeof(mpw));
+  mpbinit(&cand, size);
+  if( wksp == NULL || cand.modl == NULL ) {
+    pthread_mutex_lock(&race->lock);
+    race->failed = 1;
+    pthread_mutex_unlock(&race->lock);
+    free(wksp);
+    mpbfree(&cand);
+    return NULL;
   }
-  digestHex[2*i] = '\0';
-  
-  return(numBytes * 2 + 1);
+  rc.rng = &fips186prng;
+  rc.param = (randomGeneratorParam *) &fork;
+
+  while( 1 ) {
+    pthread_mutex_lock(&race->lock);
+    // nothing past the best try so far can win
+    if( race->failed || (race->found && race->next > race->won) ) {
+      pthread_mutex_unlock(&race->lock);
+      break;
+    }
+    k = race->next++;
+    if( fips186Fork(&fork, &race->root) ) {
+      race->failed = 1;
+      pthread_mutex_unlock(&race->lock);
+      break;
+    }
+    pthread_mutex_unlock(&race->lock);
+
+    res = mpprndtry_w(&cand, &rc, race->bits, race->t, race->min, race->max, race->f, wksp);
+    fips186Cleanup(&fork);
+
+    if( res == 0 ) {
+      pthread_mutex_lock(&race->lock);
+      if( !race->found || k < race->won ) {
+        race->found = 1;
+        race->won = k;
+        mpbcopy(race->p, &cand);
+      }
+      pthread_mutex_unlock(&race->lock);
+    }
+  }
+
+  memset(wksp, 0, (8*size+2) * sizeof(mpw));
+  free(wksp);
+  mpzero(2*size+1, cand.modl);
+  mpbfree(&cand);
+  return NULL;
 }
 
-int main() {
+// an rsakpPrimeFunction: mpprndr_w, raced over raceThreads threads
+static int racePrime(mpbarrett *p, randomGeneratorContext *rgc, size_t bits, int t, const mpnumber *min, const mpnumber *max, const mpnumber *f, mpw *wksp) {
+  struct primeRace race;
+  pthread_t threads[RACE_THREADS_MAX];
+  int i, n;
+
+  // only the FIPS 186 generator can be forked
+  if( rgc->rng != &fips186prng )
+    return mpprndr_w(p, rgc, bits, t, min, max, f, wksp);
+
+  // mpprndr_w's sanity checks on min and max, once for the whole race
+  if( min && (mpbits(min->size, min->data) > bits) )
+    return -1;
+  if( max && (mpbits(max->size, max->data) != bits) )
+    return -1;
+  if( min && max && mpgex(min->size, min->data, max->size, max->data) )
+    return -1;
+
+  memset(&race, 0, sizeof(race));
+  if( fips186Fork(&race.root, (fips186Param *) rgc->param) )
+    return -1;
+  pthread_mutex_init(&race.lock, NULL);
+  race.p = p;
+  race.bits = bits;
+  race.t = t;
+  race.min = min;
+  race.max = max;
+  race.f = f;
+
+  // this thread races too
+  for( n = 0; n < raceThreads - 1; n++ )
+    if( pthread_create(&threads[n], NULL, raceRun, &race) != 0 )
+      break;
+  raceRun(&race);
+  for( i = 0; i < n; i++ )
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&race.lock);
+  fips186Cleanup(&race.root);
+  return (race.found && !race.failed) ? 0 : -1;
+}
+
+static void print_help(char *name) {
+  fprintf(stderr, "Usage: %s [-j threads] [-s hexseed] < mac\n", name);
+  fprintf(stderr, "  -j  search for the RSA primes on this many threads (default: one per CPU)\n");
+  fprintf(stderr, "  -s  seed the generator with up to 128 hex digits, to get the same keys every time (testing only)\n");
+}
+
+
+int main(int argc, char **argv) {
   FILE *rng;
   unsigned long rnum;
   int i, j;
@@ -42,11 +174,37 @@ int main() {
   byte digest[20];
   char digestHex[41];
   sha1Param sha1param;
+  char *seedHex = NULL;
+  int ch;
+
+  raceThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  while( -1 != (ch = getopt(argc, argv, "hj:s:")) ) {
+    switch( ch ) {
+    case 'j':
+      raceThreads = strtol(optarg, NULL, 0);
+      break;
+    case 's':
+      seedHex = optarg;
+      break;
+    case 'h':
+    default:
+      print_help(argv[0]);
+      exit(1);
+    }
+  }
+  if( raceThreads < 1 )
+    raceThreads = 1;
+  if( raceThreads > RACE_THREADS_MAX )
+    raceThreads = RACE_THREADS_MAX;
 
   randomGeneratorContextInit(&rngc, randomGeneratorDefault());
   rsakpInit(&keypair);
+  if( seedHex && (rngc.rng != &fips186prng || fips186SeedHex((fips186Param *) rngc.param, seedHex)) ) {
+    fprintf(stderr, "-s wants 2 to 128 hex digits\n");
+    exit(1);
+  }
 
-  fscanf( stdin, "%02X:%02X:%02X:%02X:%02X:%02X", &(mac[0]),&(mac[1]),&(mac[2]),&(mac[3]),&(mac[4]),&(mac[5]) );
+  fscanf( stdin, "%02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX", &(mac[0]),&(mac[1]),&(mac[2]),&(mac[3]),&(mac[4]),&(mac[5]) );
   sha1Reset( &sha1param );
   sha1Update( &sha1param, mac, 6 );  // put the MAC into the SHA-1
   rngc.rng->next(rngc.param, (byte*) keyTest, 16);
@@ -77,8 +235,11 @@ int main() {
     fprintf(stdout, "%s\n", keyHex );
     fflush(stdout);
   }
-  fprintf( stderr, "Generating 2048-bit RSA key pair..." );
-  rsakpMake(&keypair, &rngc, 2048);
+  fprintf( stderr, "Generating 2048-bit RSA key pair on %d thread(s)...", raceThreads );
+  if( rsakpMakeWith(&keypair, &rngc, 2048, racePrime) ) {
+    fprintf( stderr, "failed.\n" );
+    exit(1);
+  }
   fprintf( stderr, "Done.\n" );
   fflush( stderr );
 
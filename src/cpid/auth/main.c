@@ -218,18 +218,62 @@ int initKeys(char *fname) {
 
 #endif
 
+// the key tables initKeys fills in, decoded once by decodeKeys rather than
+// from hex on every command
+static rsakp RSAkeyPairs[MAX_KEY_INDEX + 1];
+static aesParam AESencParams[MAX_KEY_INDEX + 1];
+static aesParam AESdecParams[MAX_KEY_INDEX + 1];
+
+// an index with no key in the file stays all zero, and SGN and VRF refuse it
+#define RSA_HAS_PUBLIC(kp)  ((kp)->n.size && (kp)->e.size)
+#define RSA_HAS_PRIVATE(kp) (RSA_HAS_PUBLIC(kp) && (kp)->p.size && (kp)->q.size && \
+                             (kp)->dp.size && (kp)->dq.size && (kp)->qi.size)
+
+int decodeKeys() {
+  RSAkey *k;
+  rsakp *kp;
+  int i;
+
+  for( i = 0; i <= MAX_KEY_INDEX; i++ ) {
+    if( aesSetup(&AESencParams[i], AESkeyTable[i].key, 128, ENCRYPT) )
+      return -1;
+    if( aesSetup(&AESdecParams[i], AESkeyTable[i].key, 128, DECRYPT) )
+      return -1;
+
+    k = &RSAkeyTable[i];
+    kp = &RSAkeyPairs[i];
+    rsakpInit(kp);
+    if( k->rsa_n && mpbsethex(&kp->n, k->rsa_n) )
+      return -1;
+    if( k->rsa_e && mpnsethex(&kp->e, k->rsa_e) )
+      return -1;
+    if( k->rsa_p && mpbsethex(&kp->p, k->rsa_p) )
+      return -1;
+    if( k->rsa_q && mpbsethex(&kp->q, k->rsa_q) )
+      return -1;
+    if( k->rsa_dp && mpnsethex(&kp->dp, k->rsa_dp) )
+      return -1;
+    if( k->rsa_dq && mpnsethex(&kp->dq, k->rsa_dq) )
+      return -1;
+    if( k->rsa_qi && mpnsethex(&kp->qi, k->rsa_qi) )
+      return -1;
+  }
+  return 0;
+}
+
 #define MAXDATLEN 600
+#define AES_MAX_BLOCKS ((MAXDATLEN + 1) / 32 + 1)
 void doInteraction() {
   char *cmd;
   // i/o
   opRec oprec;
-  unsigned char dataStr[256];
-  // aes
-  aesParam aesparam;
-  byte aesSrc[16];
-  byte aesDst[16];
+  unsigned char dataStr[MAXDATLEN + 2];  // parseString may put its '\0' past dataLen
+  // aes: every block of the data in one call, the last one zero-padded
+  uint32_t aesSrc[AES_MAX_BLOCKS * 4];
+  uint32_t aesDst[AES_MAX_BLOCKS * 4];
+  unsigned int aesBlocks;
   // rsa
-  rsakp keypair;
+  rsakp *keypair;
   mpnumber m, cipher, signature;
   // sha1
   byte digest[20];
@@ -257,25 +301,29 @@ void doInteraction() {
     
     switch(oprec.cipherType) {
     case CH_AES:
-      for( i = 0; i < 16; i++ ) {
-	aesSrc[i] = 0;
-      }
-      if(aesSetup(&aesparam, AESkeyTable[oprec.keyIndex].key, 128, oprec.opType == CH_ENCRYPT ? ENCRYPT : DECRYPT ))
-	continue;
-      fromhex(aesSrc, oprec.data);
+      memset(aesSrc, 0, sizeof(aesSrc));
+      aesBlocks = (fromhex((byte *)aesSrc, oprec.data) + 15) / 16;
+      if( aesBlocks == 0 )
+	aesBlocks = 1;
       if( oprec.opType == CH_ENCRYPT ) {
-	if( aesEncrypt(&aesparam, (uint32_t *)aesDst, (uint32_t *)aesSrc) )
+	if( aesEncryptECB(&AESencParams[oprec.keyIndex], aesDst, aesSrc, aesBlocks) )
 	  continue;
       } else {
-	if( aesDecrypt(&aesparam, (uint32_t *)aesDst, (uint32_t *)aesSrc) )
+	if( aesDecryptECB(&AESdecParams[oprec.keyIndex], aesDst, aesSrc, aesBlocks) )
 	  continue;
       }
-      for( i = 0; i < 16; i++ ) {
-	printf("%02X", aesDst[i] );
+      for( i = 0; i < aesBlocks * 16; i++ ) {
+	printf("%02X", ((byte *)aesDst)[i] );
       }
       printf( "\n" );
       break;
     case CH_SGN:
+      keypair = &RSAkeyPairs[oprec.keyIndex];
+      if( !RSA_HAS_PRIVATE(keypair) ) {
+	fprintf( stderr, "no private key %d.\n", oprec.keyIndex );
+	continue;
+      }
+
       // init sha1
       if( sha1Reset( &sha1param ) )
 	continue;
@@ -285,27 +333,14 @@ void doInteraction() {
 	continue;
       
       // digest now contains the 160-bit message we want to sign
-      toHex(digest, digestHex, 20);
-      // digestHex now has the correct large number representation of the message
 #if TESTING
+      toHex(digest, digestHex, 20);
       fprintf( stderr, "sha1 of message: %s\n", digestHex );
 #endif
-      // init rsa
-      rsakpInit(&keypair);
-      
-      mpbsethex(&keypair.n, RSAkeyTable[oprec.keyIndex].rsa_n);
-      mpnsethex(&keypair.e, RSAkeyTable[oprec.keyIndex].rsa_e);
-      mpbsethex(&keypair.p, RSAkeyTable[oprec.keyIndex].rsa_p);
-      mpbsethex(&keypair.q, RSAkeyTable[oprec.keyIndex].rsa_q);
-      mpnsethex(&keypair.dp, RSAkeyTable[oprec.keyIndex].rsa_dp);
-      mpnsethex(&keypair.dq, RSAkeyTable[oprec.keyIndex].rsa_dq);
-      mpnsethex(&keypair.qi, RSAkeyTable[oprec.keyIndex].rsa_qi);
-
       mpnzero(&m);
-      mpnzero(&cipher);
       mpnzero(&signature);
 
-      mpnsethex(&m, digestHex);
+      mpnsetbin(&m, digest, 20);
       
       // we are now all set to do the signing
       // need to:
@@ -313,7 +348,7 @@ void doInteraction() {
       // make test case
       // this link is very helpful in writing this code:
       // http://tools.ietf.org/html/rfc3447#page-12
-      rsapricrt(&keypair.n, &keypair.p, &keypair.q, &keypair.dp, &keypair.dq, &keypair.qi, &m, &signature);
+      rsapricrt(&keypair->n, &keypair->p, &keypair->q, &keypair->dp, &keypair->dq, &keypair->qi, &m, &signature);
       for( i = 0; i < signature.size; i++ ) {
 	printf("%08X", signature.data[i] );
       }
@@ -322,36 +357,35 @@ void doInteraction() {
 #if TESTING
       mpnfree(&m);
       mpnzero(&m);
-      rsapub(&keypair.n, &keypair.e, &signature, &m);
+      rsapub(&keypair->n, &keypair->e, &signature, &m);
       for( i = 0; i < m.size; i++ ) {
 	printf("%08X", m.data[i] );
       }
       printf( "\n" );
 #endif
 
-      rsakpFree(&keypair);
+      mpnfree(&m);
+      mpnfree(&signature);
       break;
     case CH_VRF:
-      rsakpInit(&keypair);
-      
-      mpbsethex(&keypair.n, RSAkeyTable[oprec.keyIndex].rsa_n);
-      mpnsethex(&keypair.e, RSAkeyTable[oprec.keyIndex].rsa_e);
-      mpbsethex(&keypair.p, RSAkeyTable[oprec.keyIndex].rsa_p);
-      mpbsethex(&keypair.q, RSAkeyTable[oprec.keyIndex].rsa_q);
-      mpnsethex(&keypair.dp, RSAkeyTable[oprec.keyIndex].rsa_dp);
-      mpnsethex(&keypair.dq, RSAkeyTable[oprec.keyIndex].rsa_dq);
-      mpnsethex(&keypair.qi, RSAkeyTable[oprec.keyIndex].rsa_qi);
+      keypair = &RSAkeyPairs[oprec.keyIndex];
+      if( !RSA_HAS_PUBLIC(keypair) ) {
+	fprintf( stderr, "no public key %d.\n", oprec.keyIndex );
+	continue;
+      }
 
       mpnzero(&m);
       mpnzero(&cipher);
-      mpnzero(&signature);
 
       mpnsethex(&m, oprec.data);
-      rsapub(&keypair.n, &keypair.e, &m, &cipher);
+      rsapub(&keypair->n, &keypair->e, &m, &cipher);
 
       for( i = 0; i < cipher.size; i++ ) 
 	printf("%08X", cipher.data[i]);
       printf( "\n" );
+
+      mpnfree(&m);
+      mpnfree(&cipher);
       break;
       
     case CH_SHA:
@@ -405,7 +439,7 @@ int main( int argc, char **argv ) {
     exit( 1 );
   }
   
-  if( initKeys(argv[1]) ) {
+  if( initKeys(argv[1]) || decodeKeys() ) {
     printf( "Error in reading in key file, aborting.\n" );
     exit(1);
   }
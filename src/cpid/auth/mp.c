@@ -31,6 +31,7 @@
 
 #include "beecrypt/mp.h"
 #include "beecrypt/mpopt.h"
+#include "mpcomba.h"
 
 #ifndef ASM_MPZERO
 void mpzero(size_t size, mpw* data)
@@ -570,6 +571,48 @@ int mpsubx(size_t xsize, mpw* xdata, size_t ysize, const mpw* ydata)
 }
 #endif
 
+#ifndef ASM_MPCSUBX
+int mpcsubx(size_t xsize, mpw* xdata, size_t ysize, const mpw* ydata)
+{
+	/*
+	 * Both passes touch every word and turn carries into arithmetic
+	 * rather than branches, so the time taken doesn't depend on the
+	 * values, nor on whether the subtraction was kept.
+	 */
+	register mpw load, temp, y, mask;
+	register mpw carry = 0, c;
+	register size_t i;
+
+	/* x -= y, all the way up */
+	for (i = 1; i <= xsize; i++)
+	{
+		y = (i <= ysize) ? ydata[ysize-i] : 0;
+		load = xdata[xsize-i];
+		temp = load - y;
+		c = (load < y);
+		load = temp - carry;
+		carry = c | (temp < carry);
+		xdata[xsize-i] = load;
+	}
+
+	/* if that went below zero, add y back */
+	mask = -carry;
+	carry = 0;
+	for (i = 1; i <= xsize; i++)
+	{
+		y = ((i <= ysize) ? ydata[ysize-i] : 0) & mask;
+		load = xdata[xsize-i];
+		temp = load + y;
+		c = (temp < y);
+		load = temp + carry;
+		carry = c | (load < carry);
+		xdata[xsize-i] = load;
+	}
+
+	return (int) (mask + 1);
+}
+#endif
+
 #ifndef ASM_MPNEG
 void mpneg(size_t size, mpw* data)
 {
@@ -826,6 +869,33 @@ void mpsqr(mpw* result, size_t size, const mpw* data)
 }
 #endif
 
+#ifndef ASM_MPCOMBAMUL
+void mpcombamul(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const mpw* ydata)
+{
+	if (xsize == 0 || ysize == 0)
+	{
+		mpzero(xsize + ysize, result);
+		return;
+	}
+	if (xsize == ysize && mpfixmul(result, xsize, xdata, ydata) == 0)
+		return;
+
+	MPCOMBA_MUL(result, xsize, xdata, ysize, ydata);
+}
+#endif
+
+#ifndef ASM_MPCOMBASQR
+void mpcombasqr(mpw* result, size_t size, const mpw* data)
+{
+	if (size == 0)
+		return;
+	if (mpfixsqr(result, size, data) == 0)
+		return;
+
+	MPCOMBA_SQR(result, size, data);
+}
+#endif
+
 #ifndef ASM_MPSIZE
 size_t mpsize(size_t size, const mpw* data)
 {
@@ -1233,6 +1303,103 @@ int mpextgcd_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw
 }
 #endif
 
+#ifndef ASM_MPODDINV_W
+/* needs workspace of (4*size+4) words */
+/* used to compute the modular inverse when the modulus is odd */
+int mpoddinv_w(size_t size, const mpw* xdata, const mpw* ydata, mpw* result, mpw* wksp)
+{
+	/*
+	 * Pass the (odd) modulus as xdata and the number to be inverted, less
+	 * than the modulus, as ydata; returns 1 if the inverse exists.
+	 *
+	 * This is Kaliski's almost inverse. The first phase finds
+	 * s = y^-1 * 2^k mod x with the binary gcd, but takes out a whole run of
+	 * trailing zero bits per subtraction instead of one bit per pass. The
+	 * second phase divides out 2^k a word at a time, as Montgomery
+	 * reduction does, and only the last k mod MP_WBITS bits one at a time.
+	 */
+
+	register size_t sizep = size+1;
+	register size_t k, shift;
+	register mpw xinv, m;
+	register int i;
+
+	mpw* udata = wksp;
+	mpw* vdata = udata+sizep;
+	mpw* rdata = vdata+sizep;
+	mpw* sdata = rdata+sizep;
+
+	if (mpeven(size, xdata) || mpz(size, ydata))
+		return 0;
+
+	mpsetx(sizep, udata, size, xdata);
+	mpsetx(sizep, vdata, size, ydata);
+	mpzero(sizep, rdata);
+	mpsetw(sizep, sdata, 1);
+
+	/* u stays odd from here on, and so does v after each shift */
+	k = mprshiftlsz(sizep, vdata);
+
+	while (1)
+	{
+		if (mpgt(sizep, udata, vdata))
+		{
+			mpsub(sizep, udata, vdata);
+			mpadd(sizep, rdata, sdata);
+			shift = mprshiftlsz(sizep, udata);
+			mplshift(sizep, sdata, shift);
+		}
+		else
+		{
+			mpsub(sizep, vdata, udata);
+			mpadd(sizep, sdata, rdata);
+			if (mpz(sizep, vdata))
+			{
+				mplshift(sizep, rdata, 1);
+				k++;
+				break;
+			}
+			shift = mprshiftlsz(sizep, vdata);
+			mplshift(sizep, rdata, shift);
+		}
+		k += shift;
+	}
+
+	if (!mpisone(sizep, udata))
+		return 0;
+
+	/* r < 2x; s = x - (r mod x) = y^-1 * 2^k mod x */
+	if (mpgex(sizep, rdata, size, xdata))
+		mpsubx(sizep, rdata, size, xdata);
+	mpsetx(sizep, sdata, size, xdata);
+	mpsub(sizep, sdata, rdata);
+
+	/* -x^-1 mod 2^MP_WBITS by Newton's iteration; each step doubles the bits */
+	xinv = xdata[size-1];
+	for (i = 0; i < 5; i++)
+		xinv *= 2 - xdata[size-1] * xinv;
+	xinv = -xinv;
+
+	/* s = (s + m*x) / 2^MP_WBITS, with m chosen to clear the low word */
+	while (k >= MP_WBITS)
+	{
+		m = sdata[size] * xinv;
+		sdata[0] += mpaddmul(size, sdata+1, xdata, m);
+		mprshift(sizep, sdata, MP_WBITS);
+		k -= MP_WBITS;
+	}
+	while (k--)
+	{
+		if (mpodd(sizep, sdata))
+			mpaddx(sizep, sdata, size, xdata);
+		mpdivtwo(sizep, sdata);
+	}
+
+	mpsetx(size, result, sizep, sdata);
+	return 1;
+}
+#endif
+
 #ifndef ASM_MPPNDIV
 mpw mppndiv(mpw xhi, mpw xlo, mpw y)
 {
@@ -1280,7 +1447,10 @@ void mpmod(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const mpw*
 
 	while (qsize--)
 	{
-		q = mppndiv(rdata[0], rdata[1], msw);
+		/* a top word equal to msw would make the quotient word b or
+		 * more, which mppndiv can't return; b-1 is then an upper
+		 * bound (Knuth 4.3.1 D3) and the loop below brings it down */
+		q = (rdata[0] < msw) ? mppndiv(rdata[0], rdata[1], msw) : MP_ALLMASK;
 
 		*workspace = mpsetmul(ysize, workspace+1, ynorm, q);
 
@@ -1322,7 +1492,8 @@ void mpndivmod(mpw* result, size_t xsize, const mpw* xdata, size_t ysize, const
 
 	while (qsize--)
 	{
-		q = mppndiv(result[0], result[1], msw);
+		/* as in mpmod, b-1 when the top word equals msw */
+		q = (result[0] < msw) ? mppndiv(result[0], result[1], msw) : MP_ALLMASK;
 
 		*workspace = mpsetmul(ysize, workspace+1, ydata, q);
 
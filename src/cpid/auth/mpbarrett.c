@@ -37,6 +37,7 @@
 #include "beecrypt/mpprime.h"
 #include "beecrypt/mpnumber.h"
 #include "beecrypt/mpbarrett.h"
+#include "mpcomba.h"
 
 /*
  * mpbzero
@@ -233,7 +234,9 @@ int mpbsethex(mpbarrett* b, const char* hex)
 
 /*
  * mpbmu_w
- *  computes the Barrett 'mu' coefficient
+ *  computes the Barrett 'mu' coefficient, floor(2^(2*size*MP_WBITS) / modl),
+ *  exactly, as mpbmod_w needs it; it has to fit in size+1 words, so modl
+ *  must not be 2^((size-1)*MP_WBITS)
  *  needs workspace of (6*size+4) words
  */
 void mpbmu_w(mpbarrett* b, mpw* wksp)
@@ -325,57 +328,70 @@ void mpbrndinv_w(const mpbarrett* b, randomGeneratorContext* rc, mpw* result, mp
 }
 
 /*
- * mpbmod_w
- *  computes the barrett modular reduction of a number x, which has twice the size of b
- *  needs workspace of (2*size+2) words
+ * mpbinvbatch_w
+ *  replaces each of count numbers in data (size words each, less than b, which must be odd)
+ *  with its inverse modulo b, for one inversion and 3*(count-1) multiplications (Montgomery's trick)
+ *  returns 1 if they were all invertible, otherwise 0 with data left alone
+ *  needs workspace of ((count+5)*size+4) words
  */
-void mpbmod_w(const mpbarrett* b, const mpw* data, mpw* result, mpw* wksp)
+int mpbinvbatch_w(const mpbarrett* b, size_t count, mpw* data, mpw* wksp)
 {
-	register mpw rc;
-	register size_t sp = 2;
-	register const mpw* src = data+b->size+1;
-	register       mpw* dst = wksp+b->size+1;
-
-	rc = mpsetmul(sp, dst, b->mu, *(--src));
-	*(--dst) = rc;
-
-	while (sp <= b->size)
-	{
-		sp++;
-		if ((rc = *(--src)))
-		{
-			rc = mpaddmul(sp, dst, b->mu, rc);
-			*(--dst) = rc;
-		}
-		else
-			*(--dst) = 0;
-	}
-	if ((rc = *(--src)))
+	register size_t size = b->size;
+	register mpw* prod = wksp;
+	register mpw* inv = prod + count*size;
+	register mpw* temp = inv + size;
+	register size_t i;
+
+	if (count == 0)
+		return 1;
+	if (mpeven(size, b->modl))
+		return 0;
+
+	/* prod[i] = data[0] * ... * data[i] */
+	mpcopy(size, prod, data);
+	for (i = 1; i < count; i++)
+		mpbmulmod_w(b, size, prod+(i-1)*size, size, data+i*size, prod+i*size, temp);
+
+	if (!mpoddinv_w(size, b->modl, prod+(count-1)*size, inv, temp))
+		return 0;
+
+	/* inv holds (data[0] * ... * data[i])^-1 on the way in, and loses data[i] on the way out */
+	for (i = count-1; i > 0; i--)
 	{
-		rc = mpaddmul(sp, dst, b->mu, rc);
-		*(--dst) = rc;
+		mpbmulmod_w(b, size, inv, size, prod+(i-1)*size, prod+i*size, temp);
+		mpbmulmod_w(b, size, inv, size, data+i*size, inv, temp);
+		mpcopy(size, data+i*size, prod+i*size);
 	}
-	else
-		*(--dst) = 0;
+	mpcopy(size, data, inv);
 
-	sp = b->size;
-	rc = 0;
+	return 1;
+}
 
-	dst = wksp+b->size+1;
-	src = dst;
+/*
+ * mpbmod_w
+ *  computes the barrett modular reduction of a number x, which has twice the size of b
+ *  needs workspace of (2*size+2) words
+ */
+void mpbmod_w(const mpbarrett* b, const mpw* data, mpw* result, mpw* wksp)
+{
+	register size_t size = b->size;
 
-	*dst = mpsetmul(sp, dst+1, b->modl, *(--src));
+	if (mpfixbmod_w(b, data, result, wksp) == 0)
+		return;
 
-	while (sp > 0)
-		mpaddmul(sp--, dst, b->modl+(rc++), *(--src));
+	/* this is mpfixbmod_w with the size left variable; see mpfixed.c */
+	MPCOMBA_MULHI(wksp, size+1, size+1, data, size+1, b->mu);
+	MPCOMBA_MULLO(wksp+size+1, size+1, size+1, wksp, size, b->modl);
 
-	mpsetx(b->size+1, wksp, b->size*2, data);
-	mpsub(b->size+1, wksp, wksp+b->size+1);
+	mpcopy(size+1, wksp, data+size-1);
+	mpsub(size+1, wksp, wksp+size+1);
 
-	while (mpgex(b->size+1, wksp, b->size, b->modl))
-		mpsubx(b->size+1, wksp, b->size, b->modl);
+	/* r < 4m, so three conditional subtractions are always enough */
+	mpcsubx(size+1, wksp, size, b->modl);
+	mpcsubx(size+1, wksp, size, b->modl);
+	mpcsubx(size+1, wksp, size, b->modl);
 
-	mpcopy(b->size, result, wksp+1);
+	mpcopy(size, result, wksp+1);
 }
 
 /*
@@ -453,7 +469,7 @@ void mpbmulmod_w(const mpbarrett* b, size_t xsize, const mpw* xdata, size_t ysiz
 	if (fill)
 		mpzero(fill, temp);
 
-	mpmul(temp+fill, xsize, xdata, ysize, ydata);
+	mpcombamul(temp+fill, xsize, xdata, ysize, ydata);
 	mpbmod_w(b, temp, result, wksp);
 }
 
@@ -472,7 +488,7 @@ void mpbsqrmod_w(const mpbarrett* b, size_t xsize, const mpw* xdata, mpw* result
 	if (fill)
 		mpzero(fill, temp);
 
-	mpsqr(temp+fill, xsize, xdata);
+	mpcombasqr(temp+fill, xsize, xdata);
 	mpbmod_w(b, temp, result, wksp);
 }
 
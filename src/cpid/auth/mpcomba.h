@@ -0,0 +1,124 @@
+/*!\file mpcomba.h
+ * \brief Column-wise (Comba) multi-precision multiply and square, as
+ *  statement macros so the same code serves the generic routines in mp.c
+ *  and the fixed-size ones in mpfixed.c, where the sizes are constants.
+ *
+ *  Words are big-endian as everywhere in beecrypt; column k counts from
+ *  the least significant end and holds the products x_i*y_j, i+j == k.
+ *  Word products use mpdw if there is one, half words otherwise.
+ * \ingroup MP_m
+ */
+
+#ifndef _MPCOMBA_H
+#define _MPCOMBA_H
+
+/* c2:c1:c0 += x*y */
+#if HAVE_MPDW
+#define MPCOMBA_MULADD(c0, c1, c2, x, y) \
+	do { \
+		register mpdw _t = (mpdw) (x) * (y); \
+		_t += (c0); \
+		(c0) = (mpw) _t; \
+		_t = (_t >> MP_WBITS) + (c1); \
+		(c1) = (mpw) _t; \
+		(c2) += (mpw) (_t >> MP_WBITS); \
+	} while (0)
+#else
+#define MPCOMBA_MULADD(c0, c1, c2, x, y) \
+	do { \
+		register mpw _x = (x), _y = (y), _lo, _hi, _mid, _load; \
+		register mphw _xlo = (mphw) _x, _xhi = (mphw) (_x >> MP_HWBITS); \
+		register mphw _ylo = (mphw) _y, _yhi = (mphw) (_y >> MP_HWBITS); \
+		_lo = (mpw) _xlo * _ylo; \
+		_hi = (mpw) _xhi * _yhi; \
+		_mid = (mpw) _xhi * _ylo; \
+		_load = _lo; \
+		_lo += (_mid << MP_HWBITS); \
+		_hi += (_mid >> MP_HWBITS) + (_load > _lo); \
+		_mid = (mpw) _xlo * _yhi; \
+		_load = _lo; \
+		_lo += (_mid << MP_HWBITS); \
+		_hi += (_mid >> MP_HWBITS) + (_load > _lo); \
+		(c0) += _lo; \
+		_hi += ((c0) < _lo); \
+		(c1) += _hi; \
+		(c2) += ((c1) < _hi); \
+	} while (0)
+#endif
+
+/* the lowest rsize words of x*y into result; columns rsize and up are
+ * never formed. With rsize == xsize+ysize this is the whole product.
+ */
+#define MPCOMBA_MULLO(result, rsize, xsize, xdata, ysize, ydata) \
+	do { \
+		register mpw _c0 = 0, _c1 = 0, _c2 = 0; \
+		register size_t _i, _k, _imax; \
+		for (_k = 0; _k < (rsize); _k++) \
+		{ \
+			_imax = (_k < (xsize)) ? _k : (xsize) - 1; \
+			for (_i = (_k >= (ysize)) ? _k - (ysize) + 1 : 0; _i <= _imax; _i++) \
+				MPCOMBA_MULADD(_c0, _c1, _c2, (xdata)[(xsize)-1-_i], (ydata)[(ysize)-1-_k+_i]); \
+			(result)[(rsize)-1-_k] = _c0; \
+			_c0 = _c1; \
+			_c1 = _c2; \
+			_c2 = 0; \
+		} \
+	} while (0)
+
+#define MPCOMBA_MUL(result, xsize, xdata, ysize, ydata) \
+	MPCOMBA_MULLO(result, (xsize)+(ysize), xsize, xdata, ysize, ydata)
+
+/* the highest rsize words of x*y into result, give or take: only the two
+ * columns below them are formed for their carries, so the result can be
+ * short by one in its least significant word (for the Barrett quotient
+ * that is one extra subtraction at most)
+ */
+#define MPCOMBA_MULHI(result, rsize, xsize, xdata, ysize, ydata) \
+	do { \
+		register mpw _c0 = 0, _c1 = 0, _c2 = 0; \
+		register size_t _i, _k, _imax; \
+		for (_k = (xsize)+(ysize)-(rsize)-2; _k < (xsize)+(ysize); _k++) \
+		{ \
+			_imax = (_k < (xsize)) ? _k : (xsize) - 1; \
+			for (_i = (_k >= (ysize)) ? _k - (ysize) + 1 : 0; _i <= _imax; _i++) \
+				MPCOMBA_MULADD(_c0, _c1, _c2, (xdata)[(xsize)-1-_i], (ydata)[(ysize)-1-_k+_i]); \
+			if (_k >= (xsize)+(ysize)-(rsize)) \
+				(result)[(xsize)+(ysize)-1-_k] = _c0; \
+			_c0 = _c1; \
+			_c1 = _c2; \
+			_c2 = 0; \
+		} \
+	} while (0)
+
+/* each cross product x_i*x_j (i < j) is formed once; the column's sum
+ * d2:d1:d0 is doubled with a shift and the diagonal square added before
+ * it goes into the running total
+ */
+#define MPCOMBA_SQR(result, size, data) \
+	do { \
+		register mpw _c0 = 0, _c1 = 0, _d0, _d1, _d2, _cy; \
+		register size_t _i, _k; \
+		for (_k = 0; _k < 2*(size)-1; _k++) \
+		{ \
+			_d0 = _d1 = _d2 = 0; \
+			for (_i = (_k >= (size)) ? _k - (size) + 1 : 0; (_i << 1) < _k; _i++) \
+				MPCOMBA_MULADD(_d0, _d1, _d2, (data)[(size)-1-_i], (data)[(size)-1-_k+_i]); \
+			_d2 = (_d2 << 1) | (_d1 >> (MP_WBITS-1)); \
+			_d1 = (_d1 << 1) | (_d0 >> (MP_WBITS-1)); \
+			_d0 <<= 1; \
+			if (!(_k & 1)) \
+				MPCOMBA_MULADD(_d0, _d1, _d2, (data)[(size)-1-(_k >> 1)], (data)[(size)-1-(_k >> 1)]); \
+			_d0 += _c0; \
+			_cy = (_d0 < _c0); \
+			_d1 += _cy; \
+			_d2 += (_d1 < _cy); \
+			_d1 += _c1; \
+			_d2 += (_d1 < _c1); \
+			(result)[2*(size)-1-_k] = _d0; \
+			_c0 = _d1; \
+			_c1 = _d2; \
+		} \
+		(result)[0] = _c0; \
+	} while (0)
+
+#endif
@@ -0,0 +1,119 @@
+/*!\file mpfixed.c
+ * \brief Multi-precision multiply, square and Barrett reduction for the
+ *  operand sizes the chumby actually uses: 512-bit p and q, the 1024-bit
+ *  modulus of each private key and the 2048-bit AQS modulus.
+ *
+ *  These are the Comba kernels from mpcomba.h instantiated with constant
+ *  sizes, so the compiler folds all the loop bounds and index arithmetic
+ *  and unrolls the columns; the Makefile builds this file with loop
+ *  unrolling on. mpcombamul, mpcombasqr and mpbmod_w try these first and
+ *  fall back to their generic loops for any other size.
+ * \ingroup MP_m
+ */
+
+#define BEECRYPT_DLL_EXPORT
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "beecrypt/mp.h"
+#include "beecrypt/mpbarrett.h"
+#include "mpcomba.h"
+
+/* the three sizes in words, 16/32/64 with 32-bit words, 8/16/32 with 64 */
+#define MPFIX512	(512 / MP_WBITS)
+#define MPFIX1024	(1024 / MP_WBITS)
+#define MPFIX2048	(2048 / MP_WBITS)
+
+/*
+ * The reduction is HAC 14.42, same as mpbmod_w, with the same workspace
+ * of (2*size+2) words: q3 (the top of q1*mu, whose low half is never
+ * formed) goes in the first N+1 words, the low words of q3*m behind it,
+ * and r1-r2 ends up where q3 was.
+ *
+ * HAC's q3 is at most 2 short of the true quotient, and leaving out the
+ * low columns of q1*mu costs at most one more, so r1-r2 < 4m and three
+ * conditional subtractions always finish the job. They are done with
+ * mpcsubx, so there is no loop or compare that depends on the value.
+ */
+#define MPFIXED(BITS, N) \
+static void mpfixmul##BITS(mpw* result, const mpw* xdata, const mpw* ydata) \
+{ \
+	MPCOMBA_MUL(result, N, xdata, N, ydata); \
+} \
+\
+static void mpfixsqr##BITS(mpw* result, const mpw* data) \
+{ \
+	MPCOMBA_SQR(result, N, data); \
+} \
+\
+static void mpfixbmod##BITS(const mpbarrett* b, const mpw* data, mpw* result, mpw* wksp) \
+{ \
+	/* q3 = q1 * mu / b^(N+1), q1 being the top N+1 words of data */ \
+	MPCOMBA_MULHI(wksp, N+1, N+1, data, N+1, b->mu); \
+	/* r2 = q3 * m mod b^(N+1) */ \
+	MPCOMBA_MULLO(wksp+N+1, N+1, N+1, wksp, N, b->modl); \
+	/* r = r1 - r2, r1 being the low N+1 words of data */ \
+	mpcopy(N+1, wksp, data+N-1); \
+	mpsub(N+1, wksp, wksp+N+1); \
+	mpcsubx(N+1, wksp, N, b->modl); \
+	mpcsubx(N+1, wksp, N, b->modl); \
+	mpcsubx(N+1, wksp, N, b->modl); \
+	mpcopy(N, result, wksp+1); \
+}
+
+MPFIXED(512, MPFIX512)
+MPFIXED(1024, MPFIX1024)
+MPFIXED(2048, MPFIX2048)
+
+int mpfixmul(mpw* result, size_t size, const mpw* xdata, const mpw* ydata)
+{
+	switch (size)
+	{
+	case MPFIX512:
+		mpfixmul512(result, xdata, ydata);
+		return 0;
+	case MPFIX1024:
+		mpfixmul1024(result, xdata, ydata);
+		return 0;
+	case MPFIX2048:
+		mpfixmul2048(result, xdata, ydata);
+		return 0;
+	}
+	return -1;
+}
+
+int mpfixsqr(mpw* result, size_t size, const mpw* data)
+{
+	switch (size)
+	{
+	case MPFIX512:
+		mpfixsqr512(result, data);
+		return 0;
+	case MPFIX1024:
+		mpfixsqr1024(result, data);
+		return 0;
+	case MPFIX2048:
+		mpfixsqr2048(result, data);
+		return 0;
+	}
+	return -1;
+}
+
+int mpfixbmod_w(const mpbarrett* b, const mpw* data, mpw* result, mpw* wksp)
+{
+	switch (b->size)
+	{
+	case MPFIX512:
+		mpfixbmod512(b, data, result, wksp);
+		return 0;
+	case MPFIX1024:
+		mpfixbmod1024(b, data, result, wksp);
+		return 0;
+	case MPFIX2048:
+		mpfixbmod2048(b, data, result, wksp);
+		return 0;
+	}
+	return -1;
+}
@@ -215,7 +215,10 @@ int mpninv(mpnumber* inv, const mpnumber* k, const mpnumber* mod)
 	{
 		mpnsize(inv, size);
 		mpsetx(size, wksp, k->size, k->data);
-		rc = mpextgcd_w(size, mod->data, wksp, inv->data, wksp+size);
+		if (mpodd(size, mod->data) && mplt(size, wksp, mod->data))
+			rc = mpoddinv_w(size, mod->data, wksp, inv->data, wksp+size);
+		else
+			rc = mpextgcd_w(size, mod->data, wksp, inv->data, wksp+size);
 		free(wksp);
 	}
 
@@ -0,0 +1,446 @@
+// chumby batch provisioning: a keyset per device, straight to EEPROM images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "beecrypt/sha1.h"
+#include "beecrypt/rsakp.h"
+#include "beecrypt/fips186.h"
+#include "beecrypt/entropy.h"
+
+#include "../commonCrypto.h"
+#include "toHex.h"
+
+/***
+    genkeys makes one device's keys per run, as text, and exportKeys reads
+    that back in; for a manufacturing run that is a process and a text
+    round trip per device.  provision reads a list of MACs, one per line,
+    and writes for each the image crypto() reads from the EEPROM or from
+    cpid -k: MAXKEYS privKeyInFlash records, then the machDataInFlash.
+
+    Each device is made start to finish on one thread of a pool, with its
+    own generator forked from the main one; the forks are handed out in
+    list order, so with -s every run gives the same images.  Images are
+    written out in list order as soon as they are done, the pool running
+    at most PROVISION_AHEAD devices past the writer, and cleared once
+    written since they hold the private keys.
+
+    As genkeys does, each device gets one RSA key pair, in every record,
+    and an ID from the SHA-1 of its MAC and some random bytes; the IDs are
+    all hashed up front in one sha1Multi batch.  The keys are 1024 bits,
+    which is what the records hold.  The owner keys and entropy seeds are
+    random; the AQS public key is the same for all.
+***/
+
+#define PROVISION_THREADS_MAX 16
+#define PROVISION_AHEAD       64
+#define MAC_LEN               6
+#define ID_SALT_LEN           16
+
+struct keysetImage {  // what crypto() reads, in this order
+  struct privKeyInFlash key[MAXKEYS];
+  struct machDataInFlash mach;
+};
+
+struct device {
+  octet mac[MAC_LEN];
+  octet id[20];               // SHA-1 of the MAC and a salt
+  struct keysetImage *image;  // set once made
+  unsigned long ms;           // how long making it took
+  int failed;
+};
+
+static struct device *devices;
+static int numDevices;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolCond = PTHREAD_COND_INITIALIZER;
+static int nextClaim;     // the next device to hand out
+static int nextWrite;     // the next device to write out
+static fips186Param *root;
+
+// shared by all devices
+static octet aqsN[256], aqsE[4];
+static octet hwver[16];
+static unsigned long long firstSerial;
+static unsigned long created;
+
+static unsigned long long nowUs() {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// puts a big-endian hex number of up to 2*len digits into len octets,
+// right-aligned
+static int hexField(octet *dst, int len, const char *hex) {
+  int n = strlen(hex), i;
+  unsigned int b;
+
+  if( n == 0 || n > 2*len )
+    return -1;
+  memset(dst, 0, len);
+  dst += len - (n + 1) / 2;
+  if( n & 1 ) {
+    if( sscanf(hex, "%1x", &b) != 1 )
+      return -1;
+    *(dst++) = b;
+    hex++;
+  }
+  for( i = 0; i < n / 2; i++ ) {
+    if( sscanf(hex + 2*i, "%2x", &b) != 1 )
+      return -1;
+    dst[i] = b;
+  }
+  return 0;
+}
+
+static void putBE(octet *dst, int len, unsigned long long x) {
+  while( len-- > 0 ) {
+    dst[len] = x & 0xFF;
+    x >>= 8;
+  }
+}
+
+// the AQS public key: its modulus and exponent in hex, in that order
+static int readAqs(const char *fname) {
+  FILE *f;
+  char n[2*sizeof(aqsN) + 2], e[2*sizeof(aqsE) + 2];
+  int ok;
+
+  f = fopen(fname, "r");
+  if( f == NULL ) {
+    perror(fname);
+    return -1;
+  }
+  ok = fscanf(f, " %514[0-9A-Fa-f] %10[0-9A-Fa-f]", n, e) == 2 &&
+    hexField(aqsN, sizeof(aqsN), n) == 0 && hexField(aqsE, sizeof(aqsE), e) == 0;
+  fclose(f);
+  if( !ok )
+    fprintf(stderr, "%s: want the AQS modulus and exponent in hex\n", fname);
+  return ok ? 0 : -1;
+}
+
+// the MACs, one per line; blank lines and # comments are skipped
+static int readMacs(FILE *f) {
+  char line[128];
+  int cap = 0, lineNo = 0;
+  unsigned int m[MAC_LEN];
+  int i;
+
+  while( fgets(line, sizeof(line), f) ) {
+    lineNo++;
+    if( line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#' )
+      continue;
+    if( sscanf(line, " %2x:%2x:%2x:%2x:%2x:%2x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != MAC_LEN ) {
+      fprintf(stderr, "line %d: not a MAC: %s", lineNo, line);
+      return -1;
+    }
+    if( numDevices == cap ) {
+      cap = cap ? 2 * cap : 256;
+      devices = realloc(devices, cap * sizeof(struct device));
+      if( devices == NULL ) {
+        perror("realloc");
+        return -1;
+      }
+    }
+    memset(&devices[numDevices], 0, sizeof(struct device));
+    for( i = 0; i < MAC_LEN; i++ )
+      devices[numDevices].mac[i] = m[i];
+    numDevices++;
+  }
+  return 0;
+}
+
+// every device's ID, as genkeys makes it: the SHA-1 of the MAC and
+// ID_SALT_LEN random bytes, here all in one batch
+static int makeIds(randomGeneratorContext *rc) {
+  octet *in;
+  sha1Message *msg;
+  int i, ret = -1;
+
+  in = malloc(numDevices * (MAC_LEN + ID_SALT_LEN));
+  msg = malloc(numDevices * sizeof(sha1Message));
+  if( in == NULL || msg == NULL )
+    goto done;
+
+  for( i = 0; i < numDevices; i++ ) {
+    memcpy(in + i * (MAC_LEN + ID_SALT_LEN), devices[i].mac, MAC_LEN);
+    if( rc->rng->next(rc->param, in + i * (MAC_LEN + ID_SALT_LEN) + MAC_LEN, ID_SALT_LEN) )
+      goto done;
+    msg[i].data = in + i * (MAC_LEN + ID_SALT_LEN);
+    msg[i].size = MAC_LEN + ID_SALT_LEN;
+    msg[i].digest = devices[i].id;
+  }
+  ret = sha1Multi(numDevices, msg);
+
+ done:
+  if( in )
+    memset(in, 0, numDevices * (MAC_LEN + ID_SALT_LEN));
+  free(in);
+  free(msg);
+  return ret;
+}
+
+static int makeImage(int idx, struct keysetImage *img, randomGeneratorContext *rc) {
+  struct privKeyInFlash *k = &img->key[0];
+  struct machDataInFlash *md = &img->mach;
+  octet *digest = devices[idx].id;
+  rsakp kp;
+  int i, ret = -1;
+
+  memset(img, 0, sizeof(struct keysetImage));
+
+  rsakpInit(&kp);
+  if( rsakpMake(&kp, rc, 1024) )
+    goto done;
+
+  memcpy(k->i, digest, sizeof(k->i));
+  if( i2osp(k->p, sizeof(k->p), kp.p.modl, kp.p.size) ||
+      i2osp(k->q, sizeof(k->q), kp.q.modl, kp.q.size) ||
+      i2osp(k->dp, sizeof(k->dp), kp.dp.data, kp.dp.size) ||
+      i2osp(k->dq, sizeof(k->dq), kp.dq.data, kp.dq.size) ||
+      i2osp(k->qi, sizeof(k->qi), kp.qi.data, kp.qi.size) ||
+      i2osp(k->n, sizeof(k->n), kp.n.modl, kp.n.size) ||
+      i2osp(k->e, sizeof(k->e), kp.e.data, kp.e.size) )
+    goto done;
+  putBE(k->created, sizeof(k->created), created);
+  for( i = 1; i < MAXKEYS; i++ )
+    img->key[i] = *k;
+
+  memcpy(md->ID, digest, sizeof(md->ID));
+  putBE(md->SN, sizeof(md->SN), firstSerial + idx);
+  memcpy(md->HWVER, hwver, sizeof(md->HWVER));
+  if( rc->rng->next(rc->param, (byte *) md->OK, sizeof(md->OK)) )
+    goto done;
+  memcpy(md->AQSn, aqsN, sizeof(md->AQSn));
+  memcpy(md->AQSe, aqsE, sizeof(md->AQSe));
+  if( rc->rng->next(rc->param, (byte *) md->entropySeed, sizeof(md->entropySeed)) )
+    goto done;
+  ret = 0;
+
+ done:
+  rsakpFree(&kp);
+  return ret;
+}
+
+static void *provisionWorker(void *arg) {
+  fips186Param fork;
+  randomGeneratorContext rc;
+  struct keysetImage *img;
+  unsigned long long start;
+  int idx;
+
+  rc.rng = &fips186prng;
+  rc.param = (randomGeneratorParam *) &fork;
+
+  while( 1 ) {
+    pthread_mutex_lock(&poolLock);
+    while( nextClaim < numDevices && nextClaim >= nextWrite + PROVISION_AHEAD )
+      pthread_cond_wait(&poolCond, &poolLock);
+    if( nextClaim >= numDevices ) {
+      pthread_mutex_unlock(&poolLock);
+      break;
+    }
+    idx = nextClaim++;
+    // forked in list order, so device idx always gets the same generator
+    if( fips186Fork(&fork, root) ) {
+      devices[idx].failed = 1;
+      pthread_cond_broadcast(&poolCond);
+      pthread_mutex_unlock(&poolLock);
+      continue;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    start = nowUs();
+    img = malloc(sizeof(struct keysetImage));
+    if( img && makeImage(idx, img, &rc) ) {
+      memset(img, 0, sizeof(struct keysetImage));
+      free(img);
+      img = NULL;
+    }
+    fips186Cleanup(&fork);
+
+    pthread_mutex_lock(&poolLock);
+    devices[idx].ms = (nowUs() - start) / 1000;
+    devices[idx].image = img;
+    devices[idx].failed = (img == NULL);
+    pthread_cond_broadcast(&poolCond);
+    pthread_mutex_unlock(&poolLock);
+  }
+  return NULL;
+}
+
+static void print_help(char *name) {
+  fprintf(stderr, "Usage: %s [options] -o images [macfile]\n", name);
+  fprintf(stderr, "  Writes an EEPROM image (%d bytes) per MAC in macfile, or stdin, to images.\n",
+          (int) sizeof(struct keysetImage));
+  fprintf(stderr, "  -o file   where the images go, one after the other; - for stdout\n");
+  fprintf(stderr, "  -m file   a line per device: MAC, ID, SN, public modulus and exponent\n");
+  fprintf(stderr, "  -a file   the AQS public key: modulus and exponent in hex\n");
+  fprintf(stderr, "  -n num    the serial number of the first device (default 0)\n");
+  fprintf(stderr, "  -w hex    the hardware version, up to 32 hex digits\n");
+  fprintf(stderr, "  -j num    devices to make at once (default: one per CPU)\n");
+  fprintf(stderr, "  -s hex    seed the generator with up to 128 hex digits, to get the same\n");
+  fprintf(stderr, "            images every time, with created times of 0 (testing only)\n");
+}
+
+int main(int argc, char **argv) {
+  randomGeneratorContext rngc;
+  pthread_t threads[PROVISION_THREADS_MAX];
+  FILE *macs = stdin, *out = NULL, *manifest = NULL;
+  char *seedHex = NULL, *aqsFile = NULL;
+  char idHex[33], snHex[33], nHex[257], eHex[9], macHex[18];
+  int nthreads, started, ch, i, failed = 0;
+  unsigned long long start, msTotal = 0;
+  double secs;
+  struct device *d;
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  while( -1 != (ch = getopt(argc, argv, "a:hj:m:n:o:s:w:")) ) {
+    switch( ch ) {
+    case 'a':
+      aqsFile = optarg;
+      break;
+    case 'j':
+      nthreads = strtol(optarg, NULL, 0);
+      break;
+    case 'm':
+      manifest = fopen(optarg, "w");
+      if( manifest == NULL ) {
+        perror(optarg);
+        exit(1);
+      }
+      break;
+    case 'n':
+      firstSerial = strtoull(optarg, NULL, 0);
+      break;
+    case 'o':
+      out = strcmp(optarg, "-") ? fopen(optarg, "wb") : stdout;
+      if( out == NULL ) {
+        perror(optarg);
+        exit(1);
+      }
+      break;
+    case 's':
+      seedHex = optarg;
+      break;
+    case 'w':
+      if( hexField(hwver, sizeof(hwver), optarg) ) {
+        fprintf(stderr, "-w wants up to 32 hex digits\n");
+        exit(1);
+      }
+      break;
+    case 'h':
+    default:
+      print_help(argv[0]);
+      exit(1);
+    }
+  }
+  if( out == NULL ) {
+    print_help(argv[0]);
+    exit(1);
+  }
+  if( optind < argc ) {
+    macs = fopen(argv[optind], "r");
+    if( macs == NULL ) {
+      perror(argv[optind]);
+      exit(1);
+    }
+  }
+  if( nthreads < 1 )
+    nthreads = 1;
+  if( nthreads > PROVISION_THREADS_MAX )
+    nthreads = PROVISION_THREADS_MAX;
+
+  if( aqsFile ) {
+    if( readAqs(aqsFile) )
+      exit(1);
+  } else {
+    fprintf(stderr, "no AQS key (-a), the images will have none\n");
+  }
+  if( readMacs(macs) )
+    exit(1);
+
+  randomGeneratorContextInit(&rngc, randomGeneratorDefault());
+  if( seedHex ) {
+    if( rngc.rng != &fips186prng || fips186SeedHex((fips186Param *) rngc.param, seedHex) ) {
+      fprintf(stderr, "-s wants 2 to 128 hex digits\n");
+      exit(1);
+    }
+  } else {
+    created = time(NULL);
+  }
+  root = (fips186Param *) rngc.param;
+  if( makeIds(&rngc) ) {
+    fprintf(stderr, "Unable to make the device IDs\n");
+    exit(1);
+  }
+
+  start = nowUs();
+  for( started = 0; started < nthreads; started++ )
+    if( pthread_create(&threads[started], NULL, provisionWorker, NULL) != 0 )
+      break;
+  if( started == 0 ) {
+    perror("Unable to start provisioning threads");
+    exit(1);
+  }
+
+  // write the images out in order, as each comes in
+  for( i = 0; i < numDevices; i++ ) {
+    d = &devices[i];
+    pthread_mutex_lock(&poolLock);
+    while( d->image == NULL && !d->failed )
+      pthread_cond_wait(&poolCond, &poolLock);
+    pthread_mutex_unlock(&poolLock);
+
+    toHex(d->mac, macHex, MAC_LEN);
+    if( d->failed ) {
+      fprintf(stderr, "%s: failed\n", macHex);
+      failed++;
+    } else {
+      if( fwrite(d->image, sizeof(struct keysetImage), 1, out) != 1 ) {
+        perror("writing images");
+        exit(1);
+      }
+      toHex(d->image->mach.ID, idHex, sizeof(d->image->mach.ID));
+      if( manifest ) {
+        toHex(d->image->mach.SN, snHex, sizeof(d->image->mach.SN));
+        toHex(d->image->key[0].n, nHex, sizeof(d->image->key[0].n));
+        toHex(d->image->key[0].e, eHex, sizeof(d->image->key[0].e));
+        fprintf(manifest, "%s %s %s %s %s\n", macHex, idHex, snHex, nHex, eHex);
+      }
+      fprintf(stderr, "%s %s %lu ms\n", macHex, idHex, d->ms);
+      msTotal += d->ms;
+      memset(d->image, 0, sizeof(struct keysetImage));
+      free(d->image);
+      d->image = NULL;
+    }
+
+    pthread_mutex_lock(&poolLock);
+    nextWrite = i + 1;
+    pthread_cond_broadcast(&poolCond);
+    pthread_mutex_unlock(&poolLock);
+  }
+  fflush(out);
+
+  for( i = 0; i < started; i++ )
+    pthread_join(threads[i], NULL);
+
+  secs = (nowUs() - start) / 1e6;
+  fprintf(stderr, "%d device(s) in %.1f s on %d thread(s): %.2f devices/s, %.0f ms each\n",
+          numDevices - failed, secs, started, (numDevices - failed) / (secs > 0 ? secs : 1),
+          numDevices > failed ? (double) msTotal / (numDevices - failed) : 0.0);
+
+  if( manifest )
+    fclose(manifest);
+  if( out != stdout )
+    fclose(out);
+  return failed ? 1 : 0;
+}
@@ -139,6 +139,75 @@ int rsapricrt(const mpbarrett* n, const mpbarrett* p, const mpbarrett* q,
 	return 0;
 }
 
+int rsapricrtblind(const rsakp* kp, const mpnumber* rm, const mpnumber* rb,
+                   const mpnumber* m, mpnumber* s)
+{
+	register size_t size = kp->n.size;
+
+	/* rb and the workspace to invert it in; on the stack, so unblinding
+	 * needs nothing from the heap */
+	mpw rbx[MP_BITS_TO_WORDS(RSA_BLIND_MAXBITS)];
+	mpw wksp[4*MP_BITS_TO_WORDS(RSA_BLIND_MAXBITS)+4];
+
+	mpnumber mr, b, mb, c;
+	int rc = -1;
+
+	if (size > MP_BITS_TO_WORDS(RSA_BLIND_MAXBITS))
+		return -1;
+
+	if (mpgex(m->size, m->data, size, kp->n.modl))
+		return -1;
+
+	if (mpgex(rb->size, rb->data, size, kp->n.modl))
+		return -1;
+
+	mpnzero(&mr);
+	mpnzero(&b);
+	mpnzero(&mb);
+	mpnzero(&c);
+
+	/* b = (rm*rb)^e mod n: one exponentiation blinds with both factors */
+	mpbnmulmod(&kp->n, rm, rb, &mr);
+	if (rsapub(&kp->n, &kp->e, &mr, &b))
+		goto cleanup;
+
+	/* c = (b*m)^d mod n = rm*rb*m^d mod n */
+	mpbnmulmod(&kp->n, &b, m, &mb);
+	if (rsapricrt(&kp->n, &kp->p, &kp->q, &kp->dp, &kp->dq, &kp->qi, &mb, &c))
+		goto cleanup;
+
+	/* a faulty CRT half would leak a factor of n through c; check it first */
+	if (rsavrfy(&kp->n, &kp->e, &c, &mb) != 1)
+		goto cleanup;
+
+	/* s = c/rb mod n = rm*m^d mod n */
+	mpnsize(&mr, size);
+	if (mr.data == (mpw*) 0)
+		goto cleanup;
+	mpsetx(size, rbx, rb->size, rb->data);
+	if (!mpoddinv_w(size, kp->n.modl, rbx, mr.data, wksp))
+		goto cleanup;
+
+	mpbnmulmod(&kp->n, &mr, &c, s);
+
+	rc = 0;
+
+cleanup:
+	memset(rbx, 0, sizeof(rbx));
+	memset(wksp, 0, sizeof(wksp));
+
+	mpnwipe(&mr);
+	mpnwipe(&b);
+	mpnwipe(&mb);
+	mpnwipe(&c);
+	mpnfree(&mr);
+	mpnfree(&b);
+	mpnfree(&mb);
+	mpnfree(&c);
+
+	return rc;
+}
+
 int rsavrfy(const mpbarrett* n, const mpnumber* e,
             const mpnumber* m, const mpnumber* c)
 {
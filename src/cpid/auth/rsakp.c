@@ -37,6 +37,11 @@
  */
 
 int rsakpMake(rsakp* kp, randomGeneratorContext* rgc, size_t bits)
+{
+	return rsakpMakeWith(kp, rgc, bits, mpprndr_w);
+}
+
+int rsakpMakeWith(rsakp* kp, randomGeneratorContext* rgc, size_t bits, rsakpPrimeFunction prnd)
 {
 	/* 
 	 * Generates an RSA Keypair for use with the Chinese Remainder Theorem
@@ -64,7 +69,11 @@ int rsakpMake(rsakp* kp, randomGeneratorContext* rgc, size_t bits)
 			mpnsetw(&kp->e, 65537U);
 
 		/* generate a random prime p, so that gcd(p-1,e) = 1 */
-		mpprnd_w(&kp->p, rgc, pbits, mpptrials(pbits), &kp->e, temp);
+		if (prnd(&kp->p, rgc, pbits, mpptrials(pbits), (mpnumber*) 0, (mpnumber*) 0, &kp->e, temp))
+		{
+			free(temp);
+			return -1;
+		}
 
 		/* find out how big q should be */
 		shift = MP_WORDS_TO_BITS(nsize) - bits;
@@ -78,7 +87,7 @@ int rsakpMake(rsakp* kp, randomGeneratorContext* rgc, size_t bits)
 		mpnset(&min, nsize+1-psize, divmod);
 
 		/* generate a random prime q, with min/max constraints, so that gcd(q-1,e) = 1 */
-		if (mpprndr_w(&kp->q, rgc, qbits, mpptrials(qbits), &min, (mpnumber*) 0, &kp->e, temp))
+		if (prnd(&kp->q, rgc, qbits, mpptrials(qbits), &min, (mpnumber*) 0, &kp->e, temp))
 		{
 			/* shouldn't happen */
 			mpnfree(&min);
@@ -30,6 +30,7 @@
 #endif
 
 #include "beecrypt/sha1.h"
+#include "sha1proc.h"
 
 #if HAVE_ENDIAN_H && HAVE_ASM_BYTEORDER_H
 # include <endian.h>
@@ -84,7 +85,7 @@ int sha1Reset(register sha1Param* p)
 	b = ROTR32(b, 2)
 
 #ifndef ASM_SHA1PROCESS
-void sha1Process(sha1Param* sp)
+void sha1ProcessC(sha1Param* sp)
 {
 	register uint32_t a, b, c, d, e;
 	register uint32_t *w;
@@ -203,6 +204,24 @@ void sha1Process(sha1Param* sp)
 	sp->h[3] += d;
 	sp->h[4] += e;
 }
+
+/* the block function in use; set by sha1ProcessPick, see sha1proc.h */
+static sha1ProcessFunction sha1ProcessBlock = sha1ProcessC;
+
+#if SHA1_X86
+__attribute__((constructor)) static void sha1ProcessPick(void)
+{
+	register sha1ProcessFunction process = sha1x86Select();
+
+	if (process != (sha1ProcessFunction) 0)
+		sha1ProcessBlock = process;
+}
+#endif
+
+void sha1Process(sha1Param* sp)
+{
+	sha1ProcessBlock(sp);
+}
 #endif
 
 int sha1Update(sha1Param* sp, const byte* data, size_t size)
@@ -0,0 +1,296 @@
+/*!\file sha1mb.c
+ * \brief Multi-buffer SHA-1: many independent messages hashed side by side,
+ *  one message per SIMD lane.
+ *
+ *  A single SHA-1 is one long dependency chain, so vector units don't help
+ *  it much; but lane j of a vector can carry the state of message j, and
+ *  then every instruction of the compression function works on 4 (or 8)
+ *  messages at once. Whenever a lane's message is done its digest is
+ *  written out and the next message in the batch takes over the lane, so
+ *  messages of different lengths keep all the lanes busy.
+ *
+ *  The lanes are written with GCC's generic vector types, so the same code
+ *  serves SSE2, NEON or whatever the target has; on x86 an 8 lane copy is
+ *  compiled for AVX2. Lanes are only used where they beat hashing the
+ *  messages one at a time with the best sha1Process the CPU has. On x86
+ *  that means 8 lanes with AVX2 and no SHA extensions; 4 lanes of SSE2
+ *  lose to the SSSE3 block function, and nothing beats the SHA extensions.
+ *  Elsewhere 4 lanes are used against the portable C block function.
+ * \ingroup HASH_sha1_m
+ */
+
+#define BEECRYPT_DLL_EXPORT
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "beecrypt/sha1.h"
+#include "sha1proc.h"
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ALTIVEC__)
+# define SHA1MB_SIMD 1
+#else
+# define SHA1MB_SIMD 0
+#endif
+
+/*!\addtogroup HASH_sha1_m
+ * \{
+ */
+
+static const uint32_t k[4] = { 0x5a827999U, 0x6ed9eba1U, 0x8f1bbcdcU, 0xca62c1d6U };
+static const uint32_t hinit[5] = { 0x67452301U, 0xefcdab89U, 0x98badcfeU, 0x10325476U, 0xc3d2e1f0U };
+
+static const byte zeroes[64] = { 0 };
+
+#define LANE_DATA	0	/* taking whole blocks straight from the message */
+#define LANE_LENGTH	1	/* the padding spilled over; one more block for the length */
+#define LANE_IDLE	2	/* no message; hashes zeroes for nobody */
+
+struct sha1Lane
+{
+	const sha1Message* msg;
+	const byte* data;
+	size_t left;
+	int state;
+	byte block[64];
+};
+
+static void sha1LaneStart(struct sha1Lane* l, const sha1Message* msg)
+{
+	l->msg = msg;
+	l->data = msg->data;
+	l->left = msg->size;
+	l->state = LANE_DATA;
+}
+
+/* returns the lane's next block, and sets *last if it ends the message */
+static const byte* sha1LaneBlock(struct sha1Lane* l, int* last)
+{
+	register const byte* block;
+	register size_t n;
+
+	*last = 0;
+
+	switch (l->state)
+	{
+	case LANE_DATA:
+		if (l->left >= 64)
+		{
+			block = l->data;
+			l->data += 64;
+			l->left -= 64;
+			return block;
+		}
+		n = l->left;
+		memcpy(l->block, l->data, n);
+		l->block[n++] = 0x80;
+		memset(l->block + n, 0, 64 - n);
+		l->left = 0;
+		if (n > 56)
+		{
+			l->state = LANE_LENGTH;
+			return l->block;
+		}
+		break;
+	case LANE_LENGTH:
+		memset(l->block, 0, 56);
+		break;
+	default:
+		return zeroes;
+	}
+
+	/* the length in bits, big-endian */
+	n = l->msg->size;
+	l->block[56] = 0;
+	l->block[57] = 0;
+	l->block[58] = 0;
+	l->block[59] = (byte) (n >> 29);
+	l->block[60] = (byte) (n >> 21);
+	l->block[61] = (byte) (n >> 13);
+	l->block[62] = (byte) (n >>  5);
+	l->block[63] = (byte) (n <<  3);
+	*last = 1;
+	return l->block;
+}
+
+static void sha1LaneDigest(const struct sha1Lane* l, int i, uint32_t h)
+{
+	register byte* digest = l->msg->digest + 4*i;
+
+	digest[0] = (byte) (h >> 24);
+	digest[1] = (byte) (h >> 16);
+	digest[2] = (byte) (h >>  8);
+	digest[3] = (byte) (h      );
+}
+
+/*
+ * sha1Blocks##LANES compresses one block per lane into the vector state h;
+ * sha1Lanes##LANES runs the whole batch through LANES lanes.
+ */
+#define SHA1MB(LANES, ATTR) \
+typedef uint32_t sha1Vector##LANES __attribute__((vector_size(4*LANES))); \
+\
+ATTR static void sha1Blocks##LANES(sha1Vector##LANES* h, const byte** block) \
+{ \
+	sha1Vector##LANES w[16], a, b, c, d, e, f, t; \
+	register int i, j; \
+\
+	for (i = 0; i < 16; i++) \
+		for (j = 0; j < LANES; j++) \
+			w[i][j] = ((uint32_t) block[j][4*i] << 24) | ((uint32_t) block[j][4*i+1] << 16) | \
+			          ((uint32_t) block[j][4*i+2] << 8) | ((uint32_t) block[j][4*i+3]); \
+\
+	a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; \
+\
+	for (i = 0; i < 80; i++) \
+	{ \
+		if (i >= 16) \
+		{ \
+			t = w[(i-3)&15] ^ w[(i-8)&15] ^ w[(i-14)&15] ^ w[i&15]; \
+			w[i&15] = (t << 1) | (t >> 31); \
+		} \
+		if (i < 20) \
+			f = ((b&(c^d))^d) + k[0]; \
+		else if (i < 40) \
+			f = (b^c^d) + k[1]; \
+		else if (i < 60) \
+			f = (((b|c)&d)|(b&c)) + k[2]; \
+		else \
+			f = (b^c^d) + k[3]; \
+		t = ((a << 5) | (a >> 27)) + f + e + w[i&15]; \
+		e = d; \
+		d = c; \
+		c = (b << 30) | (b >> 2); \
+		b = a; \
+		a = t; \
+	} \
+\
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; \
+} \
+\
+ATTR static void sha1Lanes##LANES(size_t count, const sha1Message* msg) \
+{ \
+	struct sha1Lane lane[LANES]; \
+	const byte* block[LANES]; \
+	int last[LANES]; \
+	sha1Vector##LANES h[5]; \
+	register size_t next = 0; \
+	register int i, j, active = 0; \
+\
+	for (j = 0; j < LANES; j++) \
+	{ \
+		lane[j].state = LANE_IDLE; \
+		if (next < count) \
+		{ \
+			sha1LaneStart(&lane[j], msg + next++); \
+			active++; \
+		} \
+		for (i = 0; i < 5; i++) \
+			h[i][j] = hinit[i]; \
+	} \
+\
+	while (active > 0) \
+	{ \
+		for (j = 0; j < LANES; j++) \
+			block[j] = sha1LaneBlock(&lane[j], &last[j]); \
+\
+		sha1Blocks##LANES(h, block); \
+\
+		for (j = 0; j < LANES; j++) \
+		{ \
+			if (!last[j]) \
+				continue; \
+			for (i = 0; i < 5; i++) \
+			{ \
+				sha1LaneDigest(&lane[j], i, h[i][j]); \
+				h[i][j] = hinit[i]; \
+			} \
+			lane[j].state = LANE_IDLE; \
+			active--; \
+			if (next < count) \
+			{ \
+				sha1LaneStart(&lane[j], msg + next++); \
+				active++; \
+			} \
+		} \
+	} \
+}
+
+#if SHA1MB_SIMD
+SHA1MB(4, )
+#endif
+#if SHA1_X86
+SHA1MB(8, __attribute__((target("avx2"))))
+#endif
+
+static void sha1Single(size_t count, const sha1Message* msg)
+{
+	sha1Param param;
+
+	while (count--)
+	{
+		sha1Reset(&param);
+		sha1Update(&param, msg->data, msg->size);
+		sha1Digest(&param, msg->digest);
+		msg++;
+	}
+}
+
+void sha1MultiLanes(size_t count, const sha1Message* msg, int lanes)
+{
+	switch (lanes)
+	{
+	#if SHA1MB_SIMD
+	case 4:
+		sha1Lanes4(count, msg);
+		break;
+	#endif
+	#if SHA1_X86
+	case 8:
+		sha1Lanes8(count, msg);
+		break;
+	#endif
+	default:
+		sha1Single(count, msg);
+	}
+}
+
+/* the quickest way to hash a batch on this CPU; see the top of the file */
+static int sha1MultiPick(void)
+{
+	#if SHA1_X86
+	register int features = sha1x86Features();
+
+	if (features & SHA1_X86_SHANI)
+		return 1;
+	if (features & SHA1_X86_AVX2)
+		return 8;
+	if (features & SHA1_X86_SSSE3)
+		return 1;
+	#endif
+	return SHA1MB_SIMD ? 4 : 1;
+}
+
+/* lanes sha1Multi uses; set by sha1MultiSelect, see sha1proc.h */
+static int sha1MultiWidth = 0;
+
+__attribute__((constructor)) static void sha1MultiSelect(void)
+{
+	sha1MultiWidth = sha1MultiPick();
+}
+
+int sha1Multi(size_t count, const sha1Message* msg)
+{
+	register int lanes = sha1MultiWidth;
+
+	/* a lone message is quicker on its own */
+	if (count < 2)
+		lanes = 1;
+
+	sha1MultiLanes(count, msg, lanes);
+	return 0;
+}
+
+/*!\}
+ */
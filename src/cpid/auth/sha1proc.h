@@ -0,0 +1,55 @@
+/*!\file sha1proc.h
+ * \brief The SHA-1 block functions sha1Process chooses between, and the
+ *  lane counts sha1Multi does.
+ *
+ *  sha1Process uses the SHA extensions if the CPU has them, else SSSE3
+ *  for the message schedule, else the portable C code. Only the portable
+ *  one exists on anything but x86. They all take and leave the parameter
+ *  block exactly as the portable one does, so they can be swapped at any
+ *  time.
+ *
+ *  Both that choice and sha1Multi's lane count are made by constructors
+ *  in sha1.c and sha1mb.c, when the program is loaded and before it can
+ *  have started any threads, and are only read after that. Until then
+ *  sha1Process runs the portable code and sha1Multi one message at a
+ *  time.
+ * \ingroup HASH_sha1_m
+ */
+
+#ifndef _SHA1PROC_H
+#define _SHA1PROC_H
+
+#include "beecrypt/sha1.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+# define SHA1_X86 1
+#else
+# define SHA1_X86 0
+#endif
+
+typedef void (*sha1ProcessFunction)(sha1Param*);
+
+/* in sha1.c */
+void sha1ProcessC(sha1Param* sp);
+
+/* in sha1mb.c: sha1Multi with the number of lanes forced to 1, 4 or 8;
+ * 8 only if sha1x86Features has SHA1_X86_AVX2 */
+void sha1MultiLanes(size_t count, const sha1Message* msg, int lanes);
+
+#if SHA1_X86
+/* in sha1x86.c; only call these if sha1x86Select says the CPU can */
+void sha1ProcessSSSE3(sha1Param* sp);
+void sha1ProcessSHANI(sha1Param* sp);
+
+#define SHA1_X86_SSSE3	1
+#define SHA1_X86_SHANI	2
+#define SHA1_X86_AVX2	4
+
+/* which of the above (and AVX2, for sha1Multi) the CPU can run, as a
+ * mask of SHA1_X86_* */
+int sha1x86Features(void);
+/* the fastest of the above the CPU can run, or 0 if neither */
+sha1ProcessFunction sha1x86Select(void);
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/*!\file sha1x86.c
+ * \brief SHA-1 block functions for x86: one using the SHA extensions
+ *  (SHA-NI), and one that does the message schedule four words at a time
+ *  with SSSE3 and leaves the rounds to the integer unit.
+ *
+ *  Each function is compiled for its own instruction set with a target
+ *  attribute, so the rest of the library is built as before and runs on
+ *  any x86; sha1x86Select checks CPUID before handing either one out.
+ *  Both read the 64 bytes sha1Update left in sp->data as big-endian words,
+ *  which is what the portable sha1Process does by swapping them in place.
+ * \ingroup HASH_sha1_m
+ */
+
+#define BEECRYPT_DLL_EXPORT
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sha1proc.h"
+
+#if SHA1_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*!\addtogroup HASH_sha1_m
+ * \{
+ */
+
+static const uint32_t k[4] = { 0x5a827999U, 0x6ed9eba1U, 0x8f1bbcdcU, 0xca62c1d6U };
+
+/* the rounds, on w[t] + k already summed by the schedule */
+#define ROUND1(a, b, c, d, e, t) \
+	e += ROTL32(a, 5) + ((b&(c^d))^d) + wk[t];	\
+	b = ROTR32(b, 2)
+
+#define ROUND2(a, b, c, d, e, t) \
+	e += ROTL32(a, 5) + (b^c^d) + wk[t];	\
+	b = ROTR32(b, 2)
+
+#define ROUND3(a, b, c, d, e, t) \
+	e += ROTL32(a, 5) + (((b|c)&d)|(b&c)) + wk[t];	\
+	b = ROTR32(b, 2)
+
+#define ROUNDS5(ROUND, t) \
+	ROUND(a,b,c,d,e,t  ); \
+	ROUND(e,a,b,c,d,t+1); \
+	ROUND(d,e,a,b,c,t+2); \
+	ROUND(c,d,e,a,b,t+3); \
+	ROUND(b,c,d,e,a,t+4)
+
+__attribute__((target("ssse3")))
+void sha1ProcessSSSE3(sha1Param* sp)
+{
+	register uint32_t a, b, c, d, e;
+	register int i;
+	uint32_t wk[80];
+	__m128i w[20], x, fix;
+
+	/* picks the bytes of each word in big-endian order */
+	const __m128i swap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	for (i = 0; i < 4; i++)
+		w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sp->data + 4*i)), swap);
+
+	/*
+	 * w[t] = ROTL1(w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16]) for four t at once.
+	 * The last of the four needs the first one's result as its w[t-3];
+	 * it goes in as zero, and ROTL1 of the missing term, which is ROTL2 of
+	 * the first word before its rotate, is xored in afterwards.
+	 */
+	for (i = 4; i < 20; i++)
+	{
+		x = _mm_xor_si128(w[i-4], _mm_alignr_epi8(w[i-3], w[i-4], 8));
+		x = _mm_xor_si128(x, w[i-2]);
+		x = _mm_xor_si128(x, _mm_srli_si128(w[i-1], 4));
+		fix = _mm_slli_si128(x, 12);
+		x = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31));
+		fix = _mm_or_si128(_mm_slli_epi32(fix, 2), _mm_srli_epi32(fix, 30));
+		w[i] = _mm_xor_si128(x, fix);
+	}
+
+	for (i = 0; i < 20; i++)
+		_mm_storeu_si128((__m128i*) (wk + 4*i), _mm_add_epi32(w[i], _mm_set1_epi32((int) k[i/5])));
+
+	a = sp->h[0]; b = sp->h[1]; c = sp->h[2]; d = sp->h[3]; e = sp->h[4];
+
+	ROUNDS5(ROUND1,  0); ROUNDS5(ROUND1,  5); ROUNDS5(ROUND1, 10); ROUNDS5(ROUND1, 15);
+	ROUNDS5(ROUND2, 20); ROUNDS5(ROUND2, 25); ROUNDS5(ROUND2, 30); ROUNDS5(ROUND2, 35);
+	ROUNDS5(ROUND3, 40); ROUNDS5(ROUND3, 45); ROUNDS5(ROUND3, 50); ROUNDS5(ROUND3, 55);
+	ROUNDS5(ROUND2, 60); ROUNDS5(ROUND2, 65); ROUNDS5(ROUND2, 70); ROUNDS5(ROUND2, 75);
+
+	sp->h[0] += a;
+	sp->h[1] += b;
+	sp->h[2] += c;
+	sp->h[3] += d;
+	sp->h[4] += e;
+}
+
+/*
+ * Four rounds with the SHA extensions, in the middle of the block where
+ * the schedule is in full swing: m0 holds this group's message words,
+ * and the groups 1, 2 and 3 ahead are brought along in m1, m2 and m3.
+ * e alternates between e0 and e1 from one group to the next.
+ */
+#define SHANI_ROUNDS(ein, eout, m0, m1, m2, m3, f) \
+	ein = _mm_sha1nexte_epu32(ein, m0); \
+	eout = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, ein, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha1ProcessSHANI(sha1Param* sp)
+{
+	__m128i abcd, abcdsave, e0, e1, esave, m0, m1, m2, m3;
+
+	/* picks the bytes of the block in reverse, so w[0] ends up on top */
+	const __m128i swap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) sp->h), 0x1b);
+	e0 = _mm_set_epi32((int) sp->h[4], 0, 0, 0);
+	abcdsave = abcd;
+	esave = e0;
+
+	/* rounds 0-15 load the block as they go */
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sp->data + 0)), swap);
+	e0 = _mm_add_epi32(e0, m0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sp->data + 4)), swap);
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+	m0 = _mm_sha1msg1_epu32(m0, m1);
+
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sp->data + 8)), swap);
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+	m1 = _mm_sha1msg1_epu32(m1, m2);
+	m0 = _mm_xor_si128(m0, m2);
+
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (sp->data + 12)), swap);
+	SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+
+	/* rounds 16-67 */
+	SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+	SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+	SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+	SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+	SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+	SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+	SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+	SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+	SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+	SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+	SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+	SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+	SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+
+	/* rounds 68-79, with nothing left to schedule past w[79] */
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	m2 = _mm_sha1msg2_epu32(m2, m1);
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+	m3 = _mm_xor_si128(m3, m1);
+
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	m3 = _mm_sha1msg2_epu32(m3, m2);
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+	e1 = _mm_sha1nexte_epu32(e1, m3);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+	e0 = _mm_sha1nexte_epu32(e0, esave);
+	abcd = _mm_add_epi32(abcd, abcdsave);
+
+	_mm_storeu_si128((__m128i*) sp->h, _mm_shuffle_epi32(abcd, 0x1b));
+	sp->h[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+int sha1x86Features(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int features = 0, sse41, avx = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	if (ecx & bit_SSSE3)
+		features |= SHA1_X86_SSSE3;
+	sse41 = ((ecx & bit_SSE4_1) != 0);
+
+	/* AVX2 also needs the OS to save the ymm registers */
+	if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+	{
+		__asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+		avx = ((eax & 6) == 6);
+	}
+
+	if (__get_cpuid_max(0, (unsigned int*) 0) >= 7)
+	{
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if ((ebx & bit_SHA) && (features & SHA1_X86_SSSE3) && sse41)
+			features |= SHA1_X86_SHANI;
+		if ((ebx & bit_AVX2) && avx)
+			features |= SHA1_X86_AVX2;
+	}
+
+	return features;
+}
+
+sha1ProcessFunction sha1x86Select(void)
+{
+	register int features = sha1x86Features();
+
+	if (features & SHA1_X86_SHANI)
+		return sha1ProcessSHANI;
+	if (features & SHA1_X86_SSSE3)
+		return sha1ProcessSSSE3;
+	return (sha1ProcessFunction) 0;
+}
+
+/*!\}
+ */
+
+#endif
@@ -3,13 +3,22 @@
 #include "beecrypt/sha1.h"
 #include "beecrypt/aes.h"
 #include <string.h>
+#include <stdlib.h>
 #include "beecrypt/rsa.h"
+#include "beecrypt/mpprime.h"
 #include "beecrypt/fips186.h"
 #include "beecrypt/entropy.h"
+#include "sha1proc.h"
+#include "aesproc.h"
+#include <time.h>
+#if SHA1_X86
+# include <x86intrin.h>
+#endif
 
 //////////// entropy
 
 extern int entropy_dev_urandom(byte* data, size_t size);
+extern int entropy_getrandom(byte* data, size_t size);
 extern int randomGeneratorContextInit(randomGeneratorContext* ctxt, const randomGenerator* rng);
 extern const randomGenerator* randomGeneratorDefault();
 
@@ -141,6 +150,131 @@ int testSha1() {
   return failures;
 }
 
+#define SHA1_BENCH_BLOCKS 16384
+
+struct sha1Impl {
+  const char* name;
+  sha1ProcessFunction process;
+};
+
+/* runs every SHA-1 block function this CPU has over the same blocks as
+ * the portable one, and reports how fast each goes */
+int testSha1Impls() {
+  struct sha1Impl impl[3];
+  int i, j, n = 0, failures = 0;
+  sha1Param ref, param;
+  byte block[64];
+  clock_t start;
+  double secs;
+  #if SHA1_X86
+  unsigned long long cycles;
+  int features = sha1x86Features();
+  #endif
+
+  impl[n].name = "C";
+  impl[n++].process = sha1ProcessC;
+  #if SHA1_X86
+  if (features & SHA1_X86_SSSE3) {
+    impl[n].name = "SSSE3";
+    impl[n++].process = sha1ProcessSSSE3;
+  }
+  if (features & SHA1_X86_SHANI) {
+    impl[n].name = "SHA-NI";
+    impl[n++].process = sha1ProcessSHANI;
+  }
+  #endif
+
+  for (i = 1; i < n; i++) {
+    sha1Reset(&ref);
+    sha1Reset(&param);
+    for (j = 0; j < 1000; j++) {
+      memset(block, j, sizeof(block));
+      block[j & 63] ^= 0x5a;
+      memcpy(ref.data, block, 64);
+      memcpy(param.data, block, 64);
+      sha1ProcessC(&ref);
+      impl[i].process(&param);
+      if (memcmp(ref.h, param.h, sizeof(ref.h))) {
+        printf("SHA1 %s differs at block %d\n", impl[i].name, j);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    sha1Reset(&param);
+    start = clock();
+    #if SHA1_X86
+    cycles = __rdtsc();
+    #endif
+    for (j = 0; j < SHA1_BENCH_BLOCKS; j++)
+      impl[i].process(&param);
+    #if SHA1_X86
+    cycles = __rdtsc() - cycles;
+    #endif
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    #if SHA1_X86
+    printf("sha1 %s: %.1f cycles/byte, %.1f MB/s\n", impl[i].name,
+	   (double) cycles / (64.0 * SHA1_BENCH_BLOCKS), 64.0 * SHA1_BENCH_BLOCKS / 1e6 / secs);
+    #else
+    printf("sha1 %s: %.1f MB/s\n", impl[i].name, 64.0 * SHA1_BENCH_BLOCKS / 1e6 / secs);
+    #endif
+  }
+  return failures;
+}
+
+#define SHA1_MULTI_MSGS 1000
+
+/* sha1Multi at every lane count this CPU has must agree with hashing
+ * each message alone, over messages of every length around the block
+ * and padding boundaries */
+int testSha1Multi() {
+  static byte data[SHA1_MULTI_MSGS + 200];
+  static byte digest[SHA1_MULTI_MSGS][20];
+  static byte expect[SHA1_MULTI_MSGS][20];
+  sha1Message msg[SHA1_MULTI_MSGS];
+  sha1Param param;
+  int lanes[3] = { 1, 4, 8 };
+  int i, j, nlanes = 2, failures = 0;
+  clock_t start;
+
+  #if SHA1_X86
+  if (sha1x86Features() & SHA1_X86_AVX2)
+    nlanes = 3;
+  #endif
+
+  for (i = 0; i < (int) sizeof(data); i++)
+    data[i] = (byte) (i * 7 + (i >> 8));
+
+  for (i = 0; i < SHA1_MULTI_MSGS; i++) {
+    msg[i].data = data + (i % 200);
+    msg[i].size = (i < 200) ? i : (size_t) ((i * 37) % SHA1_MULTI_MSGS);
+    msg[i].digest = digest[i];
+    sha1Reset(&param);
+    sha1Update(&param, msg[i].data, msg[i].size);
+    sha1Digest(&param, expect[i]);
+  }
+
+  for (j = 0; j < nlanes; j++) {
+    memset(digest, 0, sizeof(digest));
+    start = clock();
+    sha1MultiLanes(SHA1_MULTI_MSGS, msg, lanes[j]);
+    printf("sha1Multi, %d lane(s): %ld us for %d messages\n", lanes[j],
+	   (long) ((clock() - start) * 1000000 / CLOCKS_PER_SEC), SHA1_MULTI_MSGS);
+    if (memcmp(digest, expect, sizeof(expect))) {
+      printf("sha1Multi with %d lanes is wrong\n", lanes[j]);
+      failures++;
+    }
+  }
+
+  memset(digest, 0, sizeof(digest));
+  if (sha1Multi(SHA1_MULTI_MSGS, msg) || memcmp(digest, expect, sizeof(expect)))
+    failures++;
+
+  return failures;
+}
+
 int testAES() {
   int i, failures = 0;
   aesParam param;
@@ -178,6 +312,355 @@ int testAES() {
   return failures;
 }
 
+/* SP 800-38A F.1.1, F.2.1 and F.5.1, all with the same key and cleartext */
+static const char* modesKey = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char* modesIV  = "000102030405060708090a0b0c0d0e0f";
+static const char* modesCtr = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char* modesPlain =
+  "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+  "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+static const char* modesECB =
+  "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf"
+  "43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4";
+static const char* modesCBC =
+  "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+  "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7";
+static const char* modesCTR =
+  "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+  "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee";
+
+#define AES_MODES_BLOCKS 67	/* a few rounds of 8 lanes and some left over */
+#define AES_BENCH_BLOCKS 65536
+
+/* every backend this CPU has, on the SP 800-38A vectors, then against
+ * aesEncrypt/aesDecrypt block by block on longer runs, in place and not;
+ * then how fast each goes */
+int testAesModes() {
+  const aesModes* impl[2];
+  aesParam enc, dec;
+  static uint32_t src[4*AES_BENCH_BLOCKS], dst[4*AES_BENCH_BLOCKS];
+  uint32_t expect[4*AES_MODES_BLOCKS], chk[16], ctr[4], iv[4];
+  byte key[32];
+  int i, j, k, n = 0, failures = 0;
+  size_t keybits;
+  clock_t start;
+  double secs;
+
+  impl[n++] = &aesModesBitsliced;
+  #if AES_X86
+  if (aesx86Select())
+    impl[n++] = aesx86Select();
+  #endif
+
+  fromhex(key, modesKey);
+  aesSetup(&enc, key, 128, ENCRYPT);
+  aesSetup(&dec, key, 128, DECRYPT);
+
+  for (i = 0; i < n; i++) {
+    fromhex((byte*) src, modesPlain);
+
+    fromhex((byte*) chk, modesECB);
+    impl[i]->encryptECB(&enc, dst, src, 4);
+    if (memcmp(dst, chk, 64)) {
+      printf("AES %s ECB encryption is wrong\n", impl[i]->name);
+      failures++;
+    }
+    impl[i]->decryptECB(&dec, dst, dst, 4);
+    if (memcmp(dst, src, 64)) {
+      printf("AES %s ECB decryption is wrong\n", impl[i]->name);
+      failures++;
+    }
+
+    fromhex((byte*) chk, modesCBC);
+    fromhex((byte*) enc.fdback, modesIV);
+    impl[i]->encryptCBC(&enc, dst, src, 3);
+    impl[i]->encryptCBC(&enc, dst + 12, src + 12, 1);
+    if (memcmp(dst, chk, 64) || memcmp(enc.fdback, chk + 12, 16)) {
+      printf("AES %s CBC encryption is wrong\n", impl[i]->name);
+      failures++;
+    }
+    fromhex((byte*) dec.fdback, modesIV);
+    impl[i]->decryptCBC(&dec, dst, dst, 4);
+    if (memcmp(dst, src, 64) || memcmp(dec.fdback, chk + 12, 16)) {
+      printf("AES %s CBC decryption is wrong\n", impl[i]->name);
+      failures++;
+    }
+
+    fromhex((byte*) chk, modesCTR);
+    fromhex((byte*) enc.fdback, modesCtr);
+    impl[i]->ctr(&enc, dst, src, 1);
+    impl[i]->ctr(&enc, dst + 4, src + 4, 3);
+    if (memcmp(dst, chk, 64)) {
+      printf("AES %s CTR is wrong\n", impl[i]->name);
+      failures++;
+    }
+  }
+
+  for (j = 0; j < 3; j++) {
+    keybits = 128 + 64*j;
+    for (k = 0; k < 32; k++)
+      key[k] = (byte) (k * 29 + j);
+    aesSetup(&enc, key, keybits, ENCRYPT);
+    aesSetup(&dec, key, keybits, DECRYPT);
+    for (k = 0; k < 4*AES_MODES_BLOCKS; k++)
+      src[k] = (uint32_t) (k * 0x9e3779b9U + j);
+    for (k = 0; k < 4; k++)
+      iv[k] = (uint32_t) (0xfffffff0U + k);
+
+    for (i = 0; i < n; i++) {
+      /* ECB */
+      for (k = 0; k < AES_MODES_BLOCKS; k++)
+	aesEncrypt(&enc, expect + 4*k, src + 4*k);
+      impl[i]->encryptECB(&enc, dst, src, AES_MODES_BLOCKS);
+      if (memcmp(dst, expect, sizeof(expect))) {
+	printf("AES-%d %s ECB encryption disagrees\n", (int) keybits, impl[i]->name);
+	failures++;
+      }
+      for (k = 0; k < AES_MODES_BLOCKS; k++)
+	aesDecrypt(&dec, expect + 4*k, src + 4*k);
+      memcpy(dst, src, sizeof(expect));
+      impl[i]->decryptECB(&dec, dst, dst, AES_MODES_BLOCKS);
+      if (memcmp(dst, expect, sizeof(expect))) {
+	printf("AES-%d %s ECB decryption disagrees\n", (int) keybits, impl[i]->name);
+	failures++;
+      }
+
+      /* CBC, both ways and back */
+      memcpy(chk, iv, 16);
+      for (k = 0; k < AES_MODES_BLOCKS; k++) {
+	chk[0] ^= src[4*k]; chk[1] ^= src[4*k+1]; chk[2] ^= src[4*k+2]; chk[3] ^= src[4*k+3];
+	aesEncrypt(&enc, chk, chk);
+	memcpy(expect + 4*k, chk, 16);
+      }
+      memcpy(enc.fdback, iv, 16);
+      impl[i]->encryptCBC(&enc, dst, src, AES_MODES_BLOCKS);
+      if (memcmp(dst, expect, sizeof(expect))) {
+	printf("AES-%d %s CBC encryption disagrees\n", (int) keybits, impl[i]->name);
+	failures++;
+      }
+      memcpy(dec.fdback, iv, 16);
+      impl[i]->decryptCBC(&dec, dst, dst, AES_MODES_BLOCKS);
+      if (memcmp(dst, src, sizeof(expect))) {
+	printf("AES-%d %s CBC decryption disagrees\n", (int) keybits, impl[i]->name);
+	failures++;
+      }
+
+      /* CTR, from a counter that carries across words */
+      memcpy(ctr, iv, 16);
+      for (k = 0; k < AES_MODES_BLOCKS; k++) {
+	byte* c = (byte*) ctr;
+	int b;
+	aesEncrypt(&enc, chk, ctr);
+	expect[4*k] = src[4*k] ^ chk[0]; expect[4*k+1] = src[4*k+1] ^ chk[1];
+	expect[4*k+2] = src[4*k+2] ^ chk[2]; expect[4*k+3] = src[4*k+3] ^ chk[3];
+	for (b = 15; b >= 0 && ++c[b] == 0; b--)
+	  ;
+      }
+      memcpy(enc.fdback, iv, 16);
+      memcpy(dst, src, sizeof(expect));
+      impl[i]->ctr(&enc, dst, dst, AES_MODES_BLOCKS);
+      if (memcmp(dst, expect, sizeof(expect)) || memcmp(enc.fdback, ctr, 16)) {
+	printf("AES-%d %s CTR disagrees\n", (int) keybits, impl[i]->name);
+	failures++;
+      }
+    }
+  }
+
+  aesSetup(&enc, key, 128, ENCRYPT);
+  start = clock();
+  for (k = 0; k < AES_BENCH_BLOCKS; k++)
+    aesEncrypt(&enc, dst + 4*k, src + 4*k);
+  secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+  printf("aes tables: %.1f MB/s\n", 16.0 * AES_BENCH_BLOCKS / 1e6 / secs);
+  for (i = 0; i < n; i++) {
+    start = clock();
+    impl[i]->encryptECB(&enc, dst, src, AES_BENCH_BLOCKS);
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf("aes %s: ECB %.1f MB/s", impl[i]->name, 16.0 * AES_BENCH_BLOCKS / 1e6 / secs);
+    start = clock();
+    impl[i]->encryptCBC(&enc, dst, src, AES_BENCH_BLOCKS);
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf(", CBC encryption %.1f MB/s", 16.0 * AES_BENCH_BLOCKS / 1e6 / secs);
+    start = clock();
+    impl[i]->ctr(&enc, dst, src, AES_BENCH_BLOCKS);
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    printf(", CTR %.1f MB/s\n", 16.0 * AES_BENCH_BLOCKS / 1e6 / secs);
+  }
+
+  return failures;
+}
+
+#define ENTROPY_DRAWS 10000
+
+/* the getrandom source must work here and not repeat itself; and how it
+ * compares with opening /dev/urandom for every draw */
+int testEntropy() {
+  byte a[16], b[16], big[1000];
+  int i, failures = 0;
+  clock_t start;
+
+  if (entropy_getrandom(a, sizeof(a)) || entropy_getrandom(b, sizeof(b)) ||
+      entropy_getrandom(big, sizeof(big))) {
+    printf("getrandom failed\n");
+    return 1;
+  }
+  if (!memcmp(a, b, sizeof(a)) || !memcmp(big, big + 500, 16)) {
+    printf("getrandom repeats itself\n");
+    failures++;
+  }
+
+  start = clock();
+  for (i = 0; i < ENTROPY_DRAWS; i++)
+    entropy_getrandom(a, sizeof(a));
+  printf("entropy getrandom: %.2f us per 16 bytes\n",
+	 (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC / ENTROPY_DRAWS);
+  start = clock();
+  for (i = 0; i < ENTROPY_DRAWS; i++)
+    entropy_dev_urandom(a, sizeof(a));
+  printf("entropy urandom: %.2f us per 16 bytes\n",
+	 (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC / ENTROPY_DRAWS);
+
+  return failures;
+}
+
+#define FIPS186_DRAWS 100000
+
+/* a forked generator must run the same chain the shared one does from the
+ * same state, until its byte counter makes it reseed, two forks of one
+ * generator must differ, and a seed must show in the next output; and
+ * what 20-byte draws cost on each */
+int testFips186() {
+  fips186Param shared, a, b;
+  static byte x[FIPS186_RESEED_BYTES + 1000], y[FIPS186_RESEED_BYTES + 1000];
+  size_t i, n;
+  int failures = 0;
+  clock_t start;
+
+  if (fips186Setup(&shared) || fips186Fork(&a, &shared) || fips186Fork(&b, &shared)) {
+    printf("fips186 setup failed\n");
+    return 1;
+  }
+
+  fips186Next(&a, x, 1000);
+  fips186Next(&b, y, 1000);
+  if (!memcmp(x, y, 1000)) {
+    printf("fips186 forks agree\n");
+    failures++;
+  }
+
+  /* b takes on a's state; one is then drawn in odd-sized pieces */
+  memcpy(b.state, a.state, sizeof(a.state));
+  b.digestremain = a.digestremain = 0;
+  b.reseedremain = a.reseedremain = FIPS186_RESEED_BYTES;
+  fips186Next(&a, x, sizeof(x));
+  for (i = 0; i < sizeof(y); i += n) {
+    n = (i % 97) + 1;
+    if (n > sizeof(y) - i)
+      n = sizeof(y) - i;
+    fips186Next(&b, y + i, n);
+  }
+  if (memcmp(x, y, FIPS186_RESEED_BYTES)) {
+    printf("fips186 output depends on how it is drawn\n");
+    failures++;
+  }
+  if (!memcmp(x + FIPS186_RESEED_BYTES + 160, y + FIPS186_RESEED_BYTES + 160, 500)) {
+    printf("fips186 doesn't reseed\n");
+    failures++;
+  }
+
+  /* from the same state with output made ahead, a seed must change the
+   * very next bytes */
+  memcpy(b.state, a.state, sizeof(a.state));
+  b.digestremain = a.digestremain = 0;
+  fips186Next(&a, x, 1);
+  fips186Next(&b, y, 1);
+  fips186Seed(&a, (const byte*) "seed", 4);
+  fips186Next(&a, x, 20);
+  fips186Next(&b, y, 20);
+  if (!memcmp(x, y, 20)) {
+    printf("fips186 seed doesn't take effect at once\n");
+    failures++;
+  }
+
+  start = clock();
+  for (i = 0; i < FIPS186_DRAWS; i++)
+    fips186Next(&shared, x, 20);
+  printf("fips186 shared: %.2f us per 20 bytes\n",
+	 (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC / FIPS186_DRAWS);
+  start = clock();
+  for (i = 0; i < FIPS186_DRAWS; i++)
+    fips186Next(&a, x, 20);
+  printf("fips186 forked: %.2f us per 20 bytes\n",
+	 (double) (clock() - start) * 1e6 / CLOCKS_PER_SEC / FIPS186_DRAWS);
+
+  fips186Cleanup(&b);
+  fips186Cleanup(&a);
+  fips186Cleanup(&shared);
+  return failures;
+}
+
+#define PRIME_DRAWS 200
+#define PRIME_BENCH 10
+
+/* small primes from the sieve must be prime by trial division, inside
+ * min and max, and hardly ever the same twice; and what a 1024-bit one
+ * costs */
+int testPrimes() {
+  randomGeneratorContext rngc;
+  mpbarrett p;
+  mpnumber min, max, e;
+  mpw wksp[8*32+2];
+  uint64_t x, d, seen[PRIME_DRAWS];
+  int i, j, repeats = 0, failures = 0;
+  clock_t start;
+
+  if (randomGeneratorContextInit(&rngc, randomGeneratorDefault()) != 0)
+    return 1;
+
+  mpbzero(&p);
+  mpnzero(&min);
+  mpnzero(&max);
+  mpnzero(&e);
+  mpnsethex(&min, "9000000000");
+  mpnsethex(&max, "c000000000");
+  mpnsetw(&e, 65537U);
+
+  for (i = 0; i < PRIME_DRAWS; i++) {
+    if (mpprndr_w(&p, &rngc, 40, mpptrials(40), &min, &max, &e, wksp)) {
+      printf("no 40-bit prime\n");
+      failures++;
+      break;
+    }
+    x = ((uint64_t) p.modl[0] << 32) | p.modl[1];
+    for (d = 3; d * d <= x && x % d; d += 2)
+      ;
+    if (d * d <= x || x < 0x9000000000ULL || x > 0xc000000000ULL || (x - 1) % 65537 == 0) {
+      printf("sieve gave %llx\n", (unsigned long long) x);
+      failures++;
+    }
+    for (j = 0; j < i; j++)
+      repeats += (seen[j] == x);
+    seen[i] = x;
+  }
+  /* there are about 1.8e9 primes in the range */
+  if (repeats > 1) {
+    printf("sieve repeats %d of %d primes\n", repeats, PRIME_DRAWS);
+    failures++;
+  }
+
+  start = clock();
+  for (i = 0; i < PRIME_BENCH; i++)
+    mpprnd_w(&p, &rngc, 1024, mpptrials(1024), &e, wksp);
+  printf("mpprnd_w: %.0f ms per 1024-bit prime\n",
+	 (double) (clock() - start) * 1000 / CLOCKS_PER_SEC / PRIME_BENCH);
+
+  mpbfree(&p);
+  mpnfree(&min);
+  mpnfree(&max);
+  mpnfree(&e);
+  return failures;
+}
+
 int testRSA() {
   int failures = 0;
 
@@ -245,14 +728,354 @@ int testRSA() {
   }
   return failures;
 }
+//////////// Comba multiply and square
+
+#define COMBA_MAXSIZE 65
+#define COMBA_ROUNDS  8
+
+/* random words, about a quarter of them zero and a quarter all ones, so
+ * the column sums hit every carry; round 0 is all ones, round 1 zero */
+static void combaOperand(randomGeneratorContext* rngc, int round, size_t size, mpw* data) {
+  byte pick[2*COMBA_MAXSIZE];
+  size_t i;
+
+  if (round < 2) {
+    for (i = 0; i < size; i++)
+      data[i] = round ? 0 : MP_ALLMASK;
+    return;
+  }
+  rngc->rng->next(rngc->param, (byte*) data, size * sizeof(mpw));
+  rngc->rng->next(rngc->param, pick, size);
+  for (i = 0; i < size; i++) {
+    if ((pick[i] & 3) == 0)
+      data[i] = 0;
+    else if ((pick[i] & 3) == 1)
+      data[i] = MP_ALLMASK;
+  }
+}
+
+/* mpcombamul and mpcombasqr against the row routines mpmul and mpsqr,
+ * for every size up to COMBA_MAXSIZE words and a second operand of a
+ * random size */
+int testComba() {
+  int failures = 0;
+  randomGeneratorContext rngc;
+  mpw x[COMBA_MAXSIZE], y[COMBA_MAXSIZE];
+  mpw r1[2*COMBA_MAXSIZE], r2[2*COMBA_MAXSIZE];
+  size_t xsize, ysize;
+  byte pick;
+  int round;
+
+  if (randomGeneratorContextInit(&rngc, randomGeneratorDefault()) != 0)
+    return 1;
+
+  for (xsize = 1; xsize <= COMBA_MAXSIZE; xsize++) {
+    for (round = 0; round < COMBA_ROUNDS; round++) {
+      rngc.rng->next(rngc.param, &pick, 1);
+      ysize = (round & 1) ? xsize : 1 + pick % COMBA_MAXSIZE;
+      combaOperand(&rngc, round, xsize, x);
+      combaOperand(&rngc, round == 1 ? 2 : round, ysize, y);
+
+      mpmul(r1, xsize, x, ysize, y);
+      mpcombamul(r2, xsize, x, ysize, y);
+      if (mpne(xsize+ysize, r1, r2)) {
+        printf("mpcombamul wrong at %d x %d words\n", (int) xsize, (int) ysize);
+        failures++;
+      }
+
+      mpsqr(r1, xsize, x);
+      mpcombasqr(r2, xsize, x);
+      if (mpne(2*xsize, r1, r2)) {
+        printf("mpcombasqr wrong at %d words\n", (int) xsize);
+        failures++;
+      }
+    }
+  }
+  return failures;
+}
+
+//////////// fixed-size kernels
+
+#define FIXED_ROUNDS 16
+
+/* mpfixmul, mpfixsqr and mpfixbmod_w at exactly the sizes they are built
+ * for, against mpmul, mpsqr and mpmod */
+int testFixed() {
+  static const size_t bits[3] = { 512, 1024, 2048 };
+  int failures = 0;
+  randomGeneratorContext rngc;
+  mpbarrett b;
+  mpw x[2*COMBA_MAXSIZE], y[COMBA_MAXSIZE];
+  mpw r1[2*COMBA_MAXSIZE], r2[2*COMBA_MAXSIZE];
+  mpw wksp[4*COMBA_MAXSIZE+4];
+  size_t size;
+  int i, round;
+
+  if (randomGeneratorContextInit(&rngc, randomGeneratorDefault()) != 0)
+    return 1;
+  mpbzero(&b);
+
+  for (i = 0; i < 3; i++) {
+    size = MP_BITS_TO_WORDS(bits[i]);
+    for (round = 0; round < FIXED_ROUNDS; round++) {
+      combaOperand(&rngc, round, size, x);
+      combaOperand(&rngc, round == 1 ? 2 : round, size, y);
+
+      mpmul(r1, size, x, size, y);
+      if (mpfixmul(r2, size, x, y) != 0 || mpne(2*size, r1, r2)) {
+        printf("mpfixmul wrong at %d bits\n", (int) bits[i]);
+        failures++;
+      }
+
+      mpsqr(r1, size, x);
+      if (mpfixsqr(r2, size, x) != 0 || mpne(2*size, r1, r2)) {
+        printf("mpfixsqr wrong at %d bits\n", (int) bits[i]);
+        failures++;
+      }
+
+      /* a full-size modulus, and a double-size number to reduce */
+      y[0] |= MP_MSBMASK;
+      mpbset(&b, size, y);
+      combaOperand(&rngc, round == 1 ? 2 : round, 2*size, x);
+      mpmod(r1, 2*size, x, size, y, wksp);
+      if (mpfixbmod_w(&b, x, r2, wksp) != 0 || mpne(size, r1+size, r2)) {
+        printf("mpfixbmod_w wrong at %d bits\n", (int) bits[i]);
+        failures++;
+      }
+    }
+  }
+  mpbfree(&b);
+  return failures;
+}
+
+//////////// Barrett reduction
+
+#define BARRETT_ROUNDS 8
+
+/* mpbmod_w against mpmod for every modulus size up to COMBA_MAXSIZE
+ * words, and mu = floor(b^2k / m) exactly, which the three subtractions
+ * at the end of mpbmod_w rely on. Moduli made of nothing but 0 and all
+ * ones words are the ones whose quotient digits come out at b or more
+ * in the division that makes mu. */
+int testBarrett() {
+  int failures = 0;
+  randomGeneratorContext rngc;
+  mpbarrett b;
+  mpw m[COMBA_MAXSIZE], x[2*COMBA_MAXSIZE];
+  mpw r1[2*COMBA_MAXSIZE+1], r2[2*COMBA_MAXSIZE+1];
+  mpw wksp[2*COMBA_MAXSIZE+2];
+  byte pick[COMBA_MAXSIZE];
+  size_t size, i;
+  int round;
+
+  if (randomGeneratorContextInit(&rngc, randomGeneratorDefault()) != 0)
+    return 1;
+  mpbzero(&b);
+
+  for (size = 1; size <= COMBA_MAXSIZE; size++) {
+    for (round = 0; round < BARRETT_ROUNDS; round++) {
+      if (round & 1) {
+        rngc.rng->next(rngc.param, pick, size);
+        for (i = 1; i < size; i++)
+          m[i] = (pick[i] & 1) ? MP_ALLMASK : 0;
+        m[0] = MP_ALLMASK;
+      } else
+        combaOperand(&rngc, round, size, m);
+      if (m[0] == 0)
+        m[0] = 1;
+      /* b^(k-1) has a mu of k+2 words, so mpbarrett can't hold it */
+      if (m[0] == 1 && mpz(size-1, m+1))
+        m[size-1] |= 2;
+      mpbset(&b, size, m);
+
+      /* mu * m <= b^2k < (mu+1) * m */
+      mpmul(r1, size+1, b.mu, size, m);
+      mpzero(2*size+1, r2);
+      r2[0] = 1;
+      if (mpsub(2*size+1, r2, r1) || mpgex(2*size+1, r2, size, m)) {
+        printf("mpbmu_w wrong at %d words\n", (int) size);
+        failures++;
+      }
+
+      combaOperand(&rngc, round == 1 ? 2 : round, 2*size, x);
+      mpmod(r1, 2*size, x, size, m, wksp);
+      mpbmod_w(&b, x, r2, wksp);
+      if (mpne(size, r1+size, r2)) {
+        printf("mpbmod_w wrong at %d words\n", (int) size);
+        failures++;
+      }
+    }
+  }
+  mpbfree(&b);
+  return failures;
+}
+
+//////////// CHAL blinding
+
+/* what the baseline cpid's chalSign signed and sent back for rn
+ * 00112233445566778899aabbccddeeff, key 0 with PID 000102...0f, the
+ * test key above and getRandom stubbed to hand out the rm and rb below */
+static const char* blind_rm  = "0102030405060708090a0b0c0d0e0f10";
+static const char* blind_rb  = "e1e2e3e4e5e6e7e8e9eaebecedeeeff0";
+/* PKCS #1 padded SHA-1 of (PAQS, rn, rm, x, h(PID), vers) */
+static const char* blind_m   =
+  "0001ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffff00302130"
+  "0906052b0e03021a0500041427d28d4d6f398015677827e42976128eb6d986a3";
+/* S(rn, rm, x, h(PID), PAQS, vers), the signature bytes on the wire */
+static const char* blind_sig =
+  "8621b02fd6826440f03bba90358f9019acb9d44545caf72f9b9e8eeca60f015b"
+  "6b8841bc7150ec5143db5e80d62455c6e889e901ef97e48b54fbca0e04008111"
+  "554e826dab46dba89677d94d46604c7b5a5afe1a360acf6d83760450d817b7c3"
+  "e77fac4c2db4b279639b31754b90967ed4d36ea6515d14808f0596e7bcaeccbe";
+
+/* rsapricrtblind must give the signature the baseline chalSign did */
+int testBlind() {
+  int failures = 0;
+  rsakp keypair;
+  mpnumber rm, rb, m, sig, expect;
+
+  rsakpInit(&keypair);
+  mpbsethex(&keypair.n, rsa_n);
+  mpnsethex(&keypair.e, rsa_e);
+  mpbsethex(&keypair.p, rsa_p);
+  mpbsethex(&keypair.q, rsa_q);
+  mpnsethex(&keypair.dp, rsa_d1);
+  mpnsethex(&keypair.dq, rsa_d2);
+  mpnsethex(&keypair.qi, rsa_c);
+
+  mpnzero(&rm);
+  mpnzero(&rb);
+  mpnzero(&m);
+  mpnzero(&sig);
+  mpnzero(&expect);
+  mpnsethex(&rm, blind_rm);
+  mpnsethex(&rb, blind_rb);
+  mpnsethex(&m, blind_m);
+  mpnsethex(&expect, blind_sig);
+
+  if (rsapricrtblind(&keypair, &rm, &rb, &m, &sig))
+    failures++;
+  else if (mpnex(expect.size, expect.data, sig.size, sig.data))
+    failures++;
+
+  /* a broken key must be caught by the check, not signed with */
+  keypair.dp.data[keypair.dp.size-1] ^= 1;
+  if (rsapricrtblind(&keypair, &rm, &rb, &m, &sig) == 0)
+    failures++;
+
+  mpnfree(&expect);
+  mpnfree(&sig);
+  mpnfree(&m);
+  mpnfree(&rb);
+  mpnfree(&rm);
+  rsakpFree(&keypair);
+  return failures;
+}
+
+//////////// modular inversion
+
+#define INV_BATCH  8
+#define INV_ROUNDS 200
+
+/* checks mpoddinv_w and mpbinvbatch_w against mpextgcd_w, and times them */
+int testInv() {
+  int failures = 0;
+  mpbarrett n;
+  randomGeneratorContext rngc;
+  mpw *x, *a, *b, *wksp;
+  size_t size;
+  clock_t start;
+  int i;
+
+  if (randomGeneratorContextInit(&rngc, randomGeneratorDefault()) != 0)
+    return 1;
+
+  mpbzero(&n);
+  mpbsethex(&n, rsa_n);
+  size = n.size;
+
+  x = (mpw*) malloc(INV_BATCH * size * sizeof(mpw));
+  a = (mpw*) malloc(INV_BATCH * size * sizeof(mpw));
+  b = (mpw*) malloc(size * sizeof(mpw));
+  wksp = (mpw*) malloc((INV_BATCH+7) * size * sizeof(mpw) + 6 * sizeof(mpw));
+
+  for (i = 0; i < INV_BATCH; i++) {
+    mpbrnd_w(&n, &rngc, x+i*size, wksp);
+    if (!mpextgcd_w(size, n.modl, x+i*size, a+i*size, wksp))
+      failures++;
+    if (!mpoddinv_w(size, n.modl, x+i*size, b, wksp) || mpne(size, a+i*size, b))
+      failures++;
+  }
+
+  if (!mpbinvbatch_w(&n, INV_BATCH, x, wksp) || mpne(INV_BATCH*size, x, a))
+    failures++;
+
+  start = clock();
+  for (i = 0; i < INV_ROUNDS; i++)
+    mpextgcd_w(size, n.modl, a, b, wksp);
+  printf("mpextgcd_w: %ld us\n", (long) ((clock() - start) * 1000000 / CLOCKS_PER_SEC / INV_ROUNDS));
+
+  start = clock();
+  for (i = 0; i < INV_ROUNDS; i++)
+    mpoddinv_w(size, n.modl, a, b, wksp);
+  printf("mpoddinv_w: %ld us\n", (long) ((clock() - start) * 1000000 / CLOCKS_PER_SEC / INV_ROUNDS));
+
+  start = clock();
+  for (i = 0; i < INV_ROUNDS / INV_BATCH; i++)
+    mpbinvbatch_w(&n, INV_BATCH, a, wksp);
+  printf("mpbinvbatch_w: %ld us per number\n", (long) ((clock() - start) * 1000000 / CLOCKS_PER_SEC / (INV_ROUNDS / INV_BATCH * INV_BATCH)));
+
+  free(wksp);
+  free(b);
+  free(a);
+  free(x);
+  mpbfree(&n);
+  return failures;
+}
+
 int main() {
   
   if(testSha1() != 0)
     printf( "SHA1 has problems.\n");
+
+  if(testSha1Impls() != 0)
+    printf( "SHA1 block functions disagree.\n");
+
+  if(testSha1Multi() != 0)
+    printf( "SHA1 multi-buffer has problems.\n");
   
   if(testAES() != 0 ) 
     printf( "AES has problems.\n");
 
+  if(testAesModes() != 0 )
+    printf( "AES modes have problems.\n");
+
+  if(testEntropy() != 0 )
+    printf( "entropy has problems.\n");
+
+  if(testFips186() != 0 )
+    printf( "FIPS 186 has problems.\n");
+
+  if(testPrimes() != 0 )
+    printf( "prime search has problems.\n");
+
+  if(testComba() != 0 )
+    printf( "Comba kernels have problems.\n");
+
+  if(testFixed() != 0 )
+    printf( "fixed-size kernels have problems.\n");
+
+  if(testBarrett() != 0 )
+    printf( "Barrett reduction has problems.\n");
+
   if(testRSA() != 0 )
     printf( "RSA has problems.\n");
+
+  if(testBlind() != 0 )
+    printf( "CHAL blinding has problems.\n");
+
+  if(testInv() != 0 )
+    printf( "inversion has problems.\n");
 }
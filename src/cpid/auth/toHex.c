@@ -0,0 +1,21 @@
+// hex printing shared by the key tools
+// bunnie@chumby.com
+
+#include "toHex.h"
+
+char hexToAscii(char c) {
+  return(c < 0xA ? c + '0' : c + 'A' - 0xA);
+}
+
+int toHex(const byte *digest, char *digestHex, int numBytes) {
+  int i = 0;
+
+  // assume MSB first for digest
+  for( i = 0; i < numBytes; i++ ) {
+    digestHex[2*i] = hexToAscii((digest[i] & 0xF0) >> 4);
+    digestHex[2*i + 1] = hexToAscii((digest[i] & 0xF));
+  }
+  digestHex[2*i] = '\0';
+
+  return(numBytes * 2 + 1);
+}
@@ -0,0 +1,15 @@
+// hex printing shared by the key tools
+// bunnie@chumby.com
+
+#ifndef _TOHEX_H
+#define _TOHEX_H
+
+#include "beecrypt/beecrypt.h"
+
+char hexToAscii(char c);
+
+// writes numBytes of digest, MSB first, as upper-case hex digits and a
+// terminating NUL into digestHex; returns how many chars that took
+int toHex(const byte *digest, char *digestHex, int numBytes);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+  Cryptoprocessor code. Compliant to spec version 1.4.
+
+  This code is released under a BSD license.
+
+  Leaky-bucket rate limiter.
+*/
+
+/***
+    A bucket goes up by one for every event it admits and leaks one back
+    every interval, and an event that would take it over max is refused.
+
+    It's evaluated lazily: nothing runs between events, and each charge
+    first leaks however many whole intervals have gone by since the last
+    leak (carrying the remainder over, so a steady trickle of charges
+    doesn't keep resetting the clock).
+
+    Time comes from CLOCK_MONOTONIC, so stepping the wall clock -- NTP,
+    the RTC, an ALRM -- neither drains a bucket nor freezes it.
+
+    State is one level and one timestamp, and all zeroes is an empty
+    bucket, so buckets can live in static storage or a table without any
+    setup.
+***/
+
+#include "commonCrypto.h"
+
+// let whole intervals elapsed since the last leak drain out of b
+static void bucketLeak(struct leakyBucket *b, unsigned int intervalMs, unsigned long long now) {
+  unsigned long long interval = (unsigned long long) intervalMs * 1000;
+  unsigned long long leaked;
+
+  if( b->level == 0 || interval == 0 ) {
+    b->level = 0;
+    b->last = now;  // an empty bucket doesn't bank leak time
+    return;
+  }
+
+  leaked = (now - b->last) / interval;
+  if( leaked >= b->level ) {
+    b->level = 0;
+    b->last = now;
+  } else {
+    b->level -= leaked;
+    b->last += leaked * interval;
+  }
+}
+
+/*
+  Charges count events to b, which holds at most max and leaks one every
+  intervalMs. Returns 0 if they fit, -1 (charging nothing) if not.
+*/
+int bucketCharge(struct leakyBucket *b, unsigned int count, unsigned int max, unsigned int intervalMs) {
+  bucketLeak(b, intervalMs, monoUs());
+  if( count > max || b->level > max - count )
+    return -1;
+  b->level += count;
+  return 0;
+}
+
+// takes back count events charged to b that didn't happen after all
+void bucketRefund(struct leakyBucket *b, unsigned int count) {
+  if( count > b->level )
+    count = b->level;
+  b->level -= count;
+}
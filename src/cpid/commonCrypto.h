@@ -104,6 +104,53 @@ struct writer_cb_parm_s {
 
 };
 
+/* a reply under construction, see resp.c */
+#define CP_MODE_TEXT    0     // base64 text framing, the default
+#define CP_MODE_FRAMED  1     // length-prefixed frames (BINF)
+#define CP_MODE_TAGGED  2     // length-prefixed frames with a sequence tag (PIPE)
+#define FRAME_HDR_LEN      6  // 4 octet command + 2 octet big-endian length
+#define FRAME_TAG_HDR_LEN  8  // 4 octet command + 2 octet tag + 2 octet length
+#define FRAME_MAXLEN   0xFFFF
+struct cpResp {
+  int           mode;     // one of CP_MODE_*
+  char          cmd[4];   // response code
+  unsigned short tag;     // echoed back in CP_MODE_TAGGED
+  octet        *buf;      // binary payload collected so far
+  unsigned int  len;
+  unsigned int  cap;
+  int           failed;
+  int           ended;
+  int           deferred; // respEnd leaves the frame for respFlush
+};
+
+/* a challenge handed to a crypto worker, see workers.c */
+struct cpJob {
+  void        (*run)(struct cpJob *job);  // called on the worker, fills in resp
+  struct cpResp resp;                     // deferred reply
+  unsigned int  session;                  // connection the reply is for
+  void         *arg;                      // the request, owned by the job
+};
+
+/* a leaky bucket rate limiter, see bucket.c; all zeroes is an empty bucket */
+struct leakyBucket {
+  unsigned int       level;
+  unsigned long long last;      // monoUs() of the last leak
+};
+
+/* a crypto offload backend, see offload.c: AES-128-CBC under the OTP key,
+   in sessions shaped like cryptodev's */
+struct offloadSession {
+  int          fd, cfd;   // cryptodev descriptors
+  unsigned int ses;       // cryptodev session ID
+};
+struct offloadBackend {
+  const char *name;
+  int (*open)(struct offloadSession *s);
+  // len is a multiple of 16; iv is updated to the last ciphertext block
+  int (*encrypt)(struct offloadSession *s, void *dst, const void *src, unsigned int len, octet *iv);
+  int (*close)(struct offloadSession *s);
+};
+
 struct pubKeyVer3Pkt {
   octet version; // should be 3
   octet created[4];
@@ -119,34 +166,89 @@ struct pubKeyVer3Pkt {
 int base64_writer (void *cb_value, const void *buffer, size_t count, char *pem_name);
 int base64_finish_write (struct writer_cb_parm_s *parm, char *pem_name);
 
-int outputPublicKey(unsigned int keyNumber);
+int outputPublicKey(struct cpResp *r, unsigned int keyNumber);
 struct privKeyInFlash *setKey(unsigned int keyNumber);
 int b64decode(const char* s, void** datap, size_t* lenp);
 
 // defined in crypto
 int getRandom( octet *rand );
 unsigned int getOKnum();
-void doPidx(char *data, int datLen);
+void doPidx(struct cpResp *r, char *data, int datLen);
+void pidxCore(struct cpResp *r, unsigned int x);
 int GenPkcs1Padding(UINT8 *buf, int len, UINT8 *hashVal);
-void doChal(char *data, int datLen, char userType);
-void doPkey(char *data, int datLen);
-void doAlarm(char *data, int datLen);
+int clientAdmit(struct cpResp *r, unsigned int count);
+void clientRefund(unsigned int count);
+int chalAdmit(struct cpResp *r, char userType, unsigned int count);
+void doChal(struct cpResp *r, char *data, int datLen, char userType);
+void chalCore(struct cpResp *r, unsigned short x, octet *rn_os, char userType);
+void chalBatch(struct cpResp *r, unsigned int n, unsigned short *x, octet *rn_os, char userType);
+void doPkey(struct cpResp *r, char *data, int datLen);
+void doAlarm(struct cpResp *r, char *data, int datLen);
+void alarmCore(struct cpResp *r, unsigned int alarmOffset);
 void eraseKey(unsigned int keyNum);
-void sendTime();
+void sendTime(struct cpResp *r);
 void sendFail();
-void outputVersion();
-void outputSN();
-void outputCurrentOK();
-void outputHWVersion();
+void outputVersion(struct cpResp *r);
+void outputSN(struct cpResp *r);
+void outputCurrentOK(struct cpResp *r);
+void outputHWVersion(struct cpResp *r);
+void outputStats(struct cpResp *r);
+extern unsigned int chupTargetMs;
 #if RAND_ADVL_DBG
 void testRandom();
 void printADC();
 #endif
 void crypto(char *keyfile);
 
+// defined in paqs
+#define PAQS_LEN 256  // PAQS(OK) ciphertext length, i.e. size of the AQS modulus
+int paqsCompute(octet *out, unsigned int OKnum);
+void paqsStart();
+int paqsGet(octet *out, unsigned int OKnum);
+
+// defined in resp
+void respInit(struct cpResp *r, int mode, const char *cmd);
+void respBegin(struct cpResp *r, char *cmd);
+void respData(struct cpResp *r, const void *data, size_t count, char *pem_name);
+void respStatus(struct cpResp *r, char *code, char *text);
+void respEnd(struct cpResp *r);
+void respFlush(struct cpResp *r, int send);
+
+// defined in bucket
+int bucketCharge(struct leakyBucket *b, unsigned int count, unsigned int max, unsigned int intervalMs);
+void bucketRefund(struct leakyBucket *b, unsigned int count);
+
+// defined in offload
+extern const struct offloadBackend offloadCryptodev;
+extern const struct offloadBackend offloadSoft;
+const struct offloadBackend *offloadBackend();
+int offloadSoftKey(const char *fname);
+
+// defined in workers
+int workersStart();
+int workersRunning();
+int workersFull();
+int workersWakeFd();
+int workersSubmit(struct cpJob *job);
+struct cpJob *workersDone();
+void workersFanOut(void (*run)(void *arg, unsigned int i), void *arg, unsigned int n);
+
 // defined in hal
+unsigned char CPgetc();
+int CPpeek( char **p );
+void CPconsume( int n );
 int CPputs( char *str );
 int CPputc( char c );
+void CPhold();
+void CPflush();
+int CPread( void *buf, int len );
+int CPwrite( const void *buf, int len );
+int CPpoll( int timeout_ms );
+int CPwait( int want_input, int fd, int timeout_ms );
+#define CP_WAIT_INPUT  1   // CPwait: the connection has input
+#define CP_WAIT_FD     2   // CPwait: fd is readable
+unsigned int CPsession();
+unsigned long long monoUs();
 void eraseKey(unsigned int keyNum);
 void wait_ms(unsigned int var);
 unsigned short ADC_RandValue();
@@ -154,10 +256,15 @@ unsigned short ADC_RandValue();
 #define ASCII_EOF 0x0D
 #define AUTH_INTERVAL_SECS 90  // 90 seconds ... once per 90-second leak is OK with user present button!
 #define AUTH_MAX_AUTHS  15  // up to 15 auth tries -- then the leak counter starts
+#define CLIENT_CHAL_BURST      8     // challenges one client may have outstanding
+#define CLIENT_CHAL_REFILL_MS  1000  // and how often one of them leaks away
+#define CHUP_MAX_CHALS    16   // CHUPs the box takes in a burst, from all clients
+#define CHUP_INTERVAL_MS  500  // and how often one of them leaks away
 
 #define PWDWN_TIMEOUT   5  // seconds to powerdown timeout
 
 #define USER_TIMEOUT  60     // users have 60 seconds from button push to running a CHUP command
+#define CHUP_TARGET_MS 200   // default cap on how long a pipelined CHUP waits behind bulk CHALs
 
 #define CHAL_NOUSER  0       // these define values are passed through to the protocol
 #define CHAL_REQUSER 1       // so don't change them arbitrarily or you break the protocol!
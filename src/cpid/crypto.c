@@ -53,26 +53,31 @@
 #include <unistd.h>
 
 #include <sys/ioctl.h>
-//#include <linux/cryptodev.h>
-#include "cryptodev.h"
+#include <pthread.h>
 
 unsigned int keyCandidate = 0xFFFFFFFF;
 unsigned int *keyPtr = 0;
 unsigned int **keyHandle = &keyPtr;
 size_t keyLen = 0;
 unsigned int lastWasDLK0 = 0;
-byte entropy[20] = {0x01,0x0D,0x0E,0x0A,0x0D,0x0B,0x0E,0x0E,0x0F,0x05,
-		    0x10,0xD0,0xE0,0xA0,0xD0,0xB0,0xE0,0xE0,0xF0,0x50};
-unsigned int authCount = 0;
-unsigned int lastAuthTime = 0;
+// one chain per thread, so the crypto workers and the PAQS worker never
+// wait on each other for random numbers
+static __thread byte entropy[20] = {0x01,0x0D,0x0E,0x0A,0x0D,0x0B,0x0E,0x0E,0x0F,0x05,
+				    0x10,0xD0,0xE0,0xA0,0xD0,0xB0,0xE0,0xE0,0xF0,0x50};
+struct leakyBucket authBucket;  // CHALs without user presence, for the box as a whole
+static struct leakyBucket chupBucket;  // CHUPs, for the box as a whole
 unsigned int powerTimer = 0;
 
 unsigned char userPresent = 0;
 unsigned int userAuthTime = 0;
 
 #define MAX_CHAL_RESULT_LEN  1024   // supposed to be smaller than 448 bytes
-byte chalResult[MAX_CHAL_RESULT_LEN]; 
-unsigned int chalResultPtr = 0;
+// everything a CHAL reply sends, kept for the AES transcript at the end;
+// one per reply so replies can be built on more than one thread
+struct chalTranscript {
+  byte         buf[MAX_CHAL_RESULT_LEN];
+  unsigned int ptr;
+};
 
 typedef enum
 {
@@ -101,15 +106,18 @@ struct vector
 int getRandom( octet *rand ) {  // should be a 16-octet string for the return value
   struct machDataInFlash *machDat;
   octet *entropySeed;
-  unsigned short adcVal = (unsigned short) random(); //// THIS IS VERY BAD DON"T USE THIS IN PRODUCTION!!!!!111one111
+  octet fresh[16];  // from the kernel, via the library's entropy sources
   sha1Param param;
   unsigned long curTime = time(NULL);
   int i;
 
-#warning "Using random(); this is a *bad* RNG. This needs to be adapted to falconwing hardware RNG service"
+  // getrandom(2) out of a per-thread pool, so this costs no file
+  // descriptors and takes no lock; /dev/urandom if the kernel is too old
+  if (entropyGatherNext(fresh, sizeof(fresh)))
+    return -1;
 
   machDat = MACHDATABASE;
-  entropySeed = machDat->entropySeed[adcVal & 0xF];  // pick a random entropy seed to start with
+  entropySeed = machDat->entropySeed[fresh[0] & 0xF];  // pick a random entropy seed to start with
 
   if (sha1Reset(&param))
     goto cleanupRand;
@@ -117,7 +125,7 @@ int getRandom( octet *rand ) {  // should be a 16-octet string for the return va
     goto cleanupRand;
   if (sha1Update(&param, (byte *) &curTime, 4))
     goto cleanupRand;
-  if (sha1Update(&param, (byte *) &adcVal, 2))
+  if (sha1Update(&param, fresh, sizeof(fresh)))
     goto cleanupRand;
   if (sha1Update(&param, entropy, 20))
     goto cleanupRand;
@@ -128,8 +136,10 @@ int getRandom( octet *rand ) {  // should be a 16-octet string for the return va
     rand[i] = entropy[i+1];
   }
 
+  memset(fresh, 0, sizeof(fresh));
   return 0;
  cleanupRand:
+  memset(fresh, 0, sizeof(fresh));
   return -1;
 
 }
@@ -152,13 +162,11 @@ unsigned int getOKnum() {
   return i;
 }
 
-void doPidx(char *data, int datLen) {
+void doPidx(struct cpResp *r, char *data, int datLen) {
   unsigned int *kPtr = NULL;
   unsigned int **kHandle = &kPtr;
   unsigned int len = 0;
   unsigned int x = 0;
-  struct writer_cb_parm_s writer;
-  struct privKeyInFlash *pkey;
 
   //  printf( "doing pidx.\n" ); fflush(stdout);
   //  printf( "b64data: %s\n", data );
@@ -174,19 +182,24 @@ void doPidx(char *data, int datLen) {
   //  printf( "khandle, *khandle, **khandle: %lx, %lx, %lx\n", kHandle, *kHandle, **kHandle );
   x = (**kHandle) & 0xFFFF;
   //  printf( "x: %d\n", x);
+  free( *kHandle ); *kHandle = NULL;
+  pidxCore(r, x);
+}
+
+// reports the PID of key x; shared by the text and binary framings
+void pidxCore(struct cpResp *r, unsigned int x) {
+  struct privKeyInFlash *pkey;
+
   pkey = setKey(x);
   //  printf( "pkey: %lx\n", pkey );
   //  fflush(stdout);
-  free( *kHandle ); *kHandle = NULL;
-  if( pkey == NULL ) { CPputs( "FAIL" ); CPputc( ASCII_EOF ); return; }
+  if( pkey == NULL ) { respStatus( r, "FAIL", "FAIL" ); respEnd( r ); return; }
 
-  CPputs( "PIDX" );
-  memset(&writer, 0, sizeof(writer));
-  base64_writer( &writer, pkey->i, 16, NULL );
-  base64_finish_write(&writer, NULL );
+  respBegin( r, "PIDX" );
+  respData( r, pkey->i, 16, NULL );
 
   // cap the transmission
-  CPputc( ASCII_EOF );
+  respEnd( r );
 
   return;
 
@@ -231,145 +244,53 @@ int GenPkcs1Padding(UINT8 *buf, int len, UINT8 *hashVal) {
 
 }
 
-void chalBufInit() {
+void chalBufInit(struct chalTranscript *t) {
   int i = 0;
   for( i = 0; i < MAX_CHAL_RESULT_LEN; i++ ) {
-    chalResult[i] = 0;
+    t->buf[i] = 0;
   }
-  chalResultPtr = 0;
+  t->ptr = 0;
 }
 
-void chalBufUpdate(byte *data, int size) {
+void chalBufUpdate(struct chalTranscript *t, byte *data, int size) {
   int i;
 
   i = 0;
-  while( (chalResultPtr < MAX_CHAL_RESULT_LEN) && (i < size) ) {
-    chalResult[chalResultPtr] = data[i];
-    chalResultPtr++; i++;
+  while( (t->ptr < MAX_CHAL_RESULT_LEN) && (i < size) ) {
+    t->buf[t->ptr] = data[i];
+    t->ptr++; i++;
   }
-  if( chalResultPtr >= MAX_CHAL_RESULT_LEN ) {
+  if( t->ptr >= MAX_CHAL_RESULT_LEN ) {
     printf( "Warning: ran off the end of the challenge buffer, AES hash will be broken.\n" );
   }
 }
 
 #define	BLOCK_SIZE	16
-#define	KEY_SIZE	16
-
-#define STMP3XXX_DCP_ENC    0x0001
-#define STMP3XXX_DCP_DEC    0x0002
-#define STMP3XXX_DCP_ECB    0x0004
-#define STMP3XXX_DCP_CBC    0x0008
-#define STMP3XXX_DCP_CBC_INIT   0x0010
-#define STMP3XXX_DCP_OTPKEY 0x0020
-/* hash flags */
-#define STMP3XXX_DCP_INIT   0x0001
-#define STMP3XXX_DCP_UPDATE 0x0002
-#define STMP3XXX_DCP_FINAL  0x0004
-
-int chalBuffFlush() {
-  // this sends the data to the AES unit and prints it to the console in base-64
-  int fd = -1, cfd = -1;
-  struct writer_cb_parm_s writer;
 
-  struct {
-    char	in[MAX_CHAL_RESULT_LEN],
-      encrypted[MAX_CHAL_RESULT_LEN],
-      decrypted[MAX_CHAL_RESULT_LEN],
-      iv[BLOCK_SIZE],
-      key[KEY_SIZE];
-  } data;
-  int i;
-
-  struct session_op sess;
-  struct crypt_op cryp;
-
-  memset(&sess, 0, sizeof(sess));
-  memset(&cryp, 0, sizeof(cryp));
+int chalBuffFlush(struct cpResp *r, struct chalTranscript *t) {
+  // this sends the data to the AES unit (or whatever backend stands in for
+  // it, see offload.c) and appends it to the reply
+  const struct offloadBackend *b = offloadBackend();
+  struct offloadSession sess;
+  octet iv[BLOCK_SIZE];
+  octet encrypted[MAX_CHAL_RESULT_LEN];
+  unsigned int len;
 
-  for( i = 0; i < BLOCK_SIZE; i++ ) {
-    data.iv[i] = 0x00; // set initial value to 0
-  }
-  for( i = 0; i < MAX_CHAL_RESULT_LEN; i++ ) {
-    data.in[i] = 0;
-    data.encrypted[i] = 0;
-    data.decrypted[i] = 0;
-  }
-  for( i = 0; i < KEY_SIZE; i++ ) {
-    data.key[i] = 0;
-  }
-  
-  /* Open the crypto device */
-  fd = open("/dev/crypto", O_RDWR, 0);
-  if (fd < 0) {
-    perror("open(/dev/crypto)");
-    return 1;
-  }
-  
-  /* Clone file descriptor */
-  if (ioctl(fd, CRIOGET, &cfd)) {
-    perror("ioctl(CRIOGET)");
-    return 1;
-  }
+  // t->ptr rounded up to nearest 16-byte block (128-bit block); chalBufInit
+  // zeroed the rest of the buffer, so that's the padding
+  len = (t->ptr + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+  memset(iv, 0, sizeof(iv)); // set initial value to 0
 
-  /* Set close-on-exec (not really neede here) */
-  if (fcntl(cfd, F_SETFD, 1) == -1) {
-    perror("fcntl(F_SETFD)");
+  if( b->open(&sess) )
     return 1;
-  }
-  /* Get crypto session for AES128 */
-  sess.cipher = CRYPTO_CIPHER_NAME_CBC;
-  sess.alg_name = "aes";
-  sess.alg_namelen = strlen(sess.alg_name);
-  sess.keylen = KEY_SIZE;
-  // sess.key = data.key; // key is the OTP key
-  if (ioctl(cfd, CIOCGSESSION, &sess)) {
-    perror("ioctl(CIOCGSESSION)");
+  if( b->encrypt(&sess, encrypted, t->buf, len, iv) ) {
+    b->close(&sess);
     return 1;
   }
 
-  for( i = 0; i < chalResultPtr; i++ ) {
-    data.in[i] = chalResult[i];
-  }
-  while( (i % 16) != 0 ) {
-    i++;  // round up to the nearest block length
-  }
+  respData(r, encrypted, len, NULL); // send the encrypted data out!
 
-  /* Encrypt data.in to data.encrypted */
-  cryp.ses = sess.ses;
-  cryp.len = i; // chalResultPtr rounded up to nearest 16-byte block (128-bit block)
-  cryp.src = data.in;
-  cryp.dst = data.encrypted;
-  cryp.iv = data.iv;
-  cryp.op = COP_ENCRYPT;
-  cryp.flags = STMP3XXX_DCP_OTPKEY; // use the user un-readable OTP key
-  if (ioctl(cfd, CIOCCRYPT, &cryp)) {
-    perror("ioctl(CIOCCRYPT)");
-    return 1;
-  }
-	
-  memset(&writer, 0, sizeof(writer));
-  base64_writer(&writer, data.encrypted, i, NULL); // send the encrypted data out!
-  base64_finish_write(&writer, NULL );
-
-  /* Finish crypto session */
-  if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
-    perror("ioctl(CIOCFSESSION)");
-    return 1;
-  }
-  
-  /* Close cloned descriptor */
-  if (close(cfd)) {
-    perror("close(cfd)");
-    return 1;
-  }
-  
-  /* Close the original descriptor */
-  if (close(fd)) {
-    perror("close(fd)");
-    return 1;
-  }
-
-  return 0;
+  return b->close(&sess);
 }
 
 /*
@@ -412,7 +333,6 @@ output: rm, PAQS(OK), vers, S(rn, rm, x, h(PIDx), Paqs(OK), vers)
 #define M_VERS_SIZE 4
 #define M_OS_SIZE   (M_PAQS_SIZE + M_RN_SIZE + M_RM_SIZE + M_X_SIZE + M_HPID_SIZE + M_VERS_SIZE)
 #define M_OS_MPSIZE MP_BYTES_TO_WORDS(M_OS_SIZE + MP_WBYTES - 1)
-#define PS_LEN    (256 - 16 - 3)   // octet PS length = k - mLen - 3 = 256 - 16 - 3 = 237
 
 #define SIGM_PAQS_OFF  0
 #define SIGM_PAQS_SIZE 256
@@ -423,54 +343,121 @@ output: rm, PAQS(OK), vers, S(rn, rm, x, h(PIDx), Paqs(OK), vers)
 #define SIGM_OS_SIZE   (SIGM_PAQS_SIZE + SIGM_RM_SIZE + SIGM_VERS_SIZE)
 #define SIGM_OS_MPSIZE MP_BYTES_TO_WORDS(SIGM_OS_SIZE + MP_WBYTES - 1)
 
-// do the challenge response algorithm
-// peak memory usage @ 2048 bits is 4268 bytes in total heap size
-void doChal(char *data, int datLen, char userType) {
-  unsigned int *kPtr = NULL;
-  unsigned int **kHandle = &kPtr;
-  unsigned short x;
-  unsigned int len;
-  unsigned int i, j;
-  mpnumber rn;
-  mpnumber rm;
-  mpnumber rb;
-  mpnumber pid;
-  mpnumber m;
-  octet    *m_os;
-  struct writer_cb_parm_s writer;
-  byte  h_pid_oct[20];
-  octet rand_oct[16];
-  octet rb_os[16];
-  sha1Param param;
-  struct machDataInFlash *mdat = MACHDATABASE;
-  struct privKeyInFlash *pkey;
-  rsakp keypair;
-  mpnumber cipher;
-  mpnumber B;
-  mpnumber mblind;
-  mpnumber mSecBlind;
-  octet  *cipher_os;
-  unsigned int OKnum;
+/*
+  Per-client rate limits.  authBucket and chupBucket cap CHALs and CHUPs
+  for the box as a whole; these keep any one client from hogging the
+  modexp engine under those caps.  Clients are told apart by
+  connection: on the device every client runs as the same uid, so there
+  is nothing finer to go on, and a client that reconnects to get a fresh
+  bucket still runs into the box-wide ones.  A client may have CLIENT_CHAL_BURST
+  challenges outstanding, and one leaks away every CLIENT_CHAL_REFILL_MS.
+  Only the CLIENT_SLOTS most recently seen connections are tracked.
+*/
+#define CLIENT_SLOTS 8
 
-  mpnzero(&rn);
-  mpnzero(&rm);
-  mpnzero(&rb);
-  mpnzero(&pid);
-  mpnzero(&m);
-  mpnzero(&cipher);
-  mpnzero(&B);
-  mpnzero(&mblind);
-  mpnzero(&mSecBlind);
+struct clientBucket {
+  int                used;
+  unsigned int       session;    // CPsession() of the connection
+  unsigned long long seen;       // monoUs() of the last challenge
+  struct leakyBucket bucket;
+};
+
+static struct clientBucket clientBuckets[CLIENT_SLOTS];
+
+// the current connection's bucket, if it has one
+static struct clientBucket *clientFind() {
+  unsigned int session = CPsession();
+  int i;
 
-  chalBufInit();
+  for( i = 0; i < CLIENT_SLOTS; i++ ) {
+    if( clientBuckets[i].used && clientBuckets[i].session == session )
+      return &clientBuckets[i];
+  }
+  return NULL;
+}
 
+/*
+  Charges count challenges to the current client. Returns 0 if it may go
+  ahead, otherwise a BUSY reply has already been sent. A challenge that
+  is then turned away for some other reason gives them back with
+  clientRefund.
+*/
+int clientAdmit(struct cpResp *r, unsigned int count) {
+  struct clientBucket *b = clientFind();
+  int i;
+
+  if( b == NULL ) {  // new client: take a free slot, or the stalest one
+    b = &clientBuckets[0];
+    for( i = 0; i < CLIENT_SLOTS; i++ ) {
+      if( !clientBuckets[i].used ) {
+	b = &clientBuckets[i];
+	break;
+      }
+      if( clientBuckets[i].seen < b->seen )
+	b = &clientBuckets[i];
+    }
+    memset(b, 0, sizeof(struct clientBucket));
+    b->used = 1;
+    b->session = CPsession();
+  }
+  b->seen = monoUs();
+
+  if( bucketCharge(&b->bucket, count, CLIENT_CHAL_BURST, CLIENT_CHAL_REFILL_MS) != 0 ) {
+    respStatus( r, "BUSY", "BUSY\n" );
+    respEnd( r );
+    return -1;
+  }
+  return 0;
+}
+
+// hands back count challenges that clientAdmit let through but that
+// were refused afterwards, so only challenges that run are charged
+void clientRefund(unsigned int count) {
+  struct clientBucket *b = clientFind();
+
+  if( b != NULL )
+    bucketRefund(&b->bucket, count);
+}
+
+/*
+  Charges count CHALs against the auth counter before any of their payload
+  is looked at. The counter leaks one every AUTH_INTERVAL_SECS, worked out
+  right here rather than on a timer. CHUPs don't count towards it, but
+  go against chupBucket, so that reconnecting for a fresh client bucket
+  doesn't buy unlimited modexps. Returns 0 if the challenges may go
+  ahead, otherwise the reply has already been sent.
+*/
+int chalAdmit(struct cpResp *r, char userType, unsigned int count) {
   if( userType == CHAL_NOUSER ) {  // only check/increment authcount on auths that don't require user presence
-    if( authCount >= AUTH_MAX_AUTHS ) { // fail if auth count is too high
-      CPputs( "AUTHCOUNT?\n" );
-      CPputc( ASCII_EOF );
-      return;
+    if( bucketCharge(&authBucket, count, AUTH_MAX_AUTHS, AUTH_INTERVAL_SECS * 1000) != 0 ) { // fail if auth count is too high
+      respStatus( r, "ACNT", "AUTHCOUNT?\n" );
+      respEnd( r );
+      return -1;
+    }
+  } else {
+    if( bucketCharge(&chupBucket, count, CHUP_MAX_CHALS, CHUP_INTERVAL_MS) != 0 ) {
+      respStatus( r, "BUSY", "BUSY\n" );
+      respEnd( r );
+      return -1;
     }
-    authCount++;
+  }
+  return 0;
+}
+
+// text framing front end for CHAL/CHUP: pull x and rn out of the base64 payload
+void doChal(struct cpResp *r, char *data, int datLen, char userType) {
+  unsigned int *kPtr = NULL;
+  unsigned int **kHandle = &kPtr;
+  unsigned short x;
+  unsigned int len;
+  unsigned int i;
+  octet rn_os[16];
+
+  if( clientAdmit(r, 1) != 0 )
+    return;
+  if( chalAdmit(r, userType, 1) != 0 ) {
+    clientRefund(1);
+    return;
   }
 
   // ok now do the challenge
@@ -493,12 +480,10 @@ void doChal(char *data, int datLen, char userType) {
   x = ((unsigned short) **kHandle) & 0xFFFF;
   free( *kHandle ); *kHandle = NULL;
   if( x >= MAXKEYS ) { // fixed ge/gtr bug
-    CPputs( "FAIL" );
-    CPputc( ASCII_EOF );
+    respStatus( r, "FAIL", "FAIL" );
+    respEnd( r );
     return;
   }
-  pkey = setKey(x);
-  if( pkey == NULL ) { CPputs( "FAIL" ); goto cleanup; }
 
   len = 0; // per ET
   if(b64decode(&(data[5]), (void **)kHandle, &len)) { // per ET
@@ -509,125 +494,88 @@ void doChal(char *data, int datLen, char userType) {
     free( *kHandle ); *kHandle = NULL;
     return;
   }
-  mpnzero(&rn);
-  if(mpnsetbin(&rn, (byte *) *kHandle, (size_t) len) != 0) {
-    CPputs( "FAIL" );
-    free( *kHandle ); *kHandle = NULL;
-    goto cleanup;
-  }
+  memcpy(rn_os, *kHandle, 16);
   free( *kHandle ); *kHandle = NULL;
 
-  // RESP header
-  CPputs( "RESP" );
-
-  // rm, Paqs(OK), vers, S(rn, rm, x, h(PIDx), Paqs(OK), vers)
-  // 16+ 256+      16+ ..256
-  // generate rm
-  mpnzero(&rm);
-  if( getRandom( rand_oct ) != 0 ) { CPputs( "FAIL" ); CPputc( ASCII_EOF ); return; }
-  if(mpnsetbin(&rm, (byte *) rand_oct, (size_t) 16) != 0) { CPputs( "FAIL" ); goto cleanup; }
-
-  // generate hash of my PID
-  mpnzero(&pid);
-  if( sha1Reset(&param) ) { CPputs( "FAIL" ); goto cleanup; }
-  // note that this is a byte-wise big-endian big-num hash of a 16-bit number
-  if( sha1Update(&param, (byte *) pkey->i, 16 ) ) { CPputs( "FAIL" ); goto cleanup; }
-  if( sha1Digest(&param, h_pid_oct) ) { CPputs( "FAIL" ); goto cleanup; }
-  if(mpnsetbin(&pid, (byte *) h_pid_oct, (size_t) 20) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  if( sha1Reset(&param) ) { CPputs( "FAIL" ); goto cleanup; }
+  chalCore(r, x, rn_os, userType);
+}
 
-  // now build the encrypted owner key using PAQS
-  // build the padded m
-  OKnum = getOKnum();
-  m_os = calloc(256, 1);
-  if( m_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
-  i = 0;
-  m_os[i++] = 0x00;
-  m_os[i++] = 0x02;
-  for( ; i < 256; i++ ) {
-    if( i >= 2 && i < PS_LEN + 2 ) {
-      do { // generate a single, non-zero byte by repeatedly calling the prng until you get a non-zero value in byte 0
-	if( getRandom( rand_oct ) != 0 ) { CPputs( "FAIL" ); CPputc( ASCII_EOF ); return; }
-      } while( rand_oct[0] == 0x00 );
-      // assign this non-zero byte to m_os
-      m_os[i] = rand_oct[0];
-      continue;
-    }
-    if( i == PS_LEN + 2 ) {
-      m_os[i] = 0x00;
-      j = 0;
-      continue;
-    } else {
-      m_os[i] = (octet) mdat->OK[OKnum][j++];
-      // copy through the OK into m
-    }
-  }
-  mpnzero(&m);
-  if(mpnsetbin(&m, (byte *) m_os, 256) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  free(m_os); m_os = NULL;// clear out the temp bufefr
+#define CHAL_SIG_LEN  (MODULUS_LEN / 8)   // S(...) as sent on the wire
+// most (x, rn) pairs in one CHLB, so the whole transcript fits in one chalTranscript
+#define CHLB_MAX      ((MAX_CHAL_RESULT_LEN - SIGM_OS_SIZE) / CHAL_SIG_LEN)
 
-  rsakpInit(&keypair);
-  if( mpnsetbin(&keypair.e, mdat->AQSe, 4) != 0 ) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpbsetbin(&keypair.n, mdat->AQSn, 256) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  mpnzero(&cipher);
-
-  // now do the maths and print the result
-  rsapub(&keypair.n, &keypair.e, &m, &cipher);
-
-  cipher_os = calloc(MP_WORDS_TO_BYTES(cipher.size),1);
-  if( cipher_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
-  if( i2osp( cipher_os, MP_WORDS_TO_BYTES(cipher.size), cipher.data, cipher.size ) != 0 ) {
-    CPputs( "FAIL" );
-    free( cipher_os ); cipher_os = NULL;
-    goto cleanup;
-  }
-  mpnfree(&m);  // get rid of temp data
-  mpnfree(&cipher);
-  rsakpFree(&keypair);
-  // now we are carrying around the PAQS(OK) data...256 extra bytes on the heap!!!
+/*
+  Assembles the transmitted part of a CHAL reply, (PAQS(OK), rm, vers),
+  into m_os, which must hold SIGM_OS_SIZE octets.
+*/
+static void chalMessage(octet *m_os, const octet *paqs_os, const octet *rm_os, char userType) {
+  unsigned int i, j;
 
-  // at this point, do "step 4": assemble message for transmission
-  m_os = calloc(SIGM_OS_SIZE, 1);
-  if( m_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
   for( i = 0; i < SIGM_PAQS_SIZE; i++ ) {
-    m_os[i] = cipher_os[i];
-  }
-  if( i2osp( rand_oct, MP_WORDS_TO_BYTES(rm.size), rm.data, rm.size ) != 0 ) {
-    CPputs( "FAIL" );
-    goto cleanup;
+    m_os[i] = paqs_os[i];
   }
   for( j = 0, i = SIGM_RM_OFF; i < SIGM_VERS_OFF; i++, j++ ) {
-    m_os[i] = rand_oct[j];
+    m_os[i] = rm_os[j];
   }
   // version string in big-endian format
   m_os[i++] = MAJOR_VERSION;
   m_os[i++] = MINOR_VERSION;
   m_os[i++] = (octet) (userType & 0xFF); // passed in variable, careful...
   m_os[i++] = 0;
+}
 
-  memset(&writer, 0, sizeof(writer));
-  chalBufUpdate(m_os, SIGM_OS_SIZE);
-  base64_writer( &writer, m_os, SIGM_OS_SIZE, NULL );
-  base64_finish_write(&writer, NULL );
-  free( m_os ); m_os = NULL;
+/*
+  Computes S(rn, rm, x, h(PIDx), Paqs(OK), vers) with key x into sig
+  (CHAL_SIG_LEN octets), double blinded and checked before it's released.
+  Touches no shared state, so several of these can run at once. Returns 0 on success.
+*/
+static int chalSign(octet *sig, unsigned short x, const octet *rn_os, const octet *rm_os, const octet *paqs_os) {
+  unsigned int i, j;
+  mpnumber rm;
+  mpnumber rb;
+  mpnumber m;
+  octet    *m_os = NULL;
+  byte  h_pid_oct[20];
+  octet rb_os[16];
+  sha1Param param;
+  struct privKeyInFlash *pkey;
+  rsakp keypair;
+  mpnumber mblind;
+  int retval = -1;
+
+  mpnzero(&rm);
+  mpnzero(&rb);
+  mpnzero(&m);
+  mpnzero(&mblind);
+  rsakpInit(&keypair);
+
+  if( x >= MAXKEYS ) goto cleanup;
+  pkey = setKey(x);
+  if( pkey == NULL ) goto cleanup;
+
+  if(mpnsetbin(&rm, (byte *) rm_os, (size_t) 16) != 0) goto cleanup;
+
+  // generate hash of my PID
+  if( sha1Reset(&param) ) goto cleanup;
+  // note that this is a byte-wise big-endian big-num hash of a 16-bit number
+  if( sha1Update(&param, (byte *) pkey->i, 16 ) ) goto cleanup;
+  if( sha1Digest(&param, h_pid_oct) ) goto cleanup;
+  if( sha1Reset(&param) ) goto cleanup;
 
   // now build the message to sign: (rn, rm, x, h(PIDx), Paqs(OK), vers)
-  // we re-use rand_oct for this purpose
   m_os = calloc(M_OS_SIZE, 1);
-  if( m_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
+  if( m_os == NULL ) goto cleanup;
   // assemble PAQS
   for( i = 0; i < SIGM_PAQS_SIZE; i++ ) {
-    m_os[i] = cipher_os[i];
+    m_os[i] = paqs_os[i];
   }
   // assemble rn
-  if( i2osp( rand_oct, 16, rn.data, rn.size ) != 0 ) { CPputs( "FAIL" ); goto cleanup; }
   for( j = 0, i = M_RN_OFF; i < M_RM_OFF; i++, j++ ) {
-    m_os[i] = rand_oct[j];
+    m_os[i] = rn_os[j];
   }
   // assemble rm
-  if( i2osp( rand_oct, 16, rm.data, rm.size ) != 0 ) { CPputs( "FAIL" ); goto cleanup; }
   for( j = 0, i = M_RM_OFF; i < M_X_OFF; i++, j++ ) {
-    m_os[i] = rand_oct[j];
+    m_os[i] = rm_os[j];
   }
   // assemble x (4 bytes hard-coded)
   m_os[i++] = 0;
@@ -645,149 +593,210 @@ void doChal(char *data, int datLen, char userType) {
   m_os[i++] = 0;
   m_os[i++] = 0;
 
-  // we've copied cipher_os one final time, so get rid of it to make space on heap...
-  free(cipher_os); cipher_os = NULL;  // does this lead to fragmentation of the heap? eep. i wonder how good my mallocator is.
-
   // hash using SHA-1
   // re-use h_pid_oct variable to save space...
-  if( sha1Reset(&param) ) { CPputs( "FAIL" ); goto cleanup; }
-  if( sha1Update(&param, (byte *) m_os, M_OS_SIZE ) ) { CPputs( "FAIL" ); goto cleanup; }
-  if( sha1Digest(&param, h_pid_oct) ) { CPputs( "FAIL" ); goto cleanup; }
-  if( sha1Reset(&param) ) { CPputs( "FAIL" ); goto cleanup; }
+  if( sha1Reset(&param) ) goto cleanup;
+  if( sha1Update(&param, (byte *) m_os, M_OS_SIZE ) ) goto cleanup;
+  if( sha1Digest(&param, h_pid_oct) ) goto cleanup;
+  if( sha1Reset(&param) ) goto cleanup;
 
   // get rid of variables we don't need anymore
   free(m_os); m_os = NULL;
 
   // pad the digest.
   m_os = calloc(MODULUS_LEN / 8, 1);
-  if( m_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
-  if( GenPkcs1Padding( m_os, MODULUS_LEN / 8, h_pid_oct ) != 0 ) {
-    CPputs( "FAIL" ); goto cleanup;
-  }
-  mpnzero(&m);
-  if(mpnsetbin(&m, (byte *) m_os, MODULUS_LEN / 8) != 0) { CPputs( "FAIL" ); goto cleanup; }
+  if( m_os == NULL ) goto cleanup;
+  if( GenPkcs1Padding( m_os, MODULUS_LEN / 8, h_pid_oct ) != 0 ) goto cleanup;
+  if(mpnsetbin(&m, (byte *) m_os, MODULUS_LEN / 8) != 0) goto cleanup;
   free( m_os ); m_os = NULL;
   // message is now in m as an mpnumber, m_os is gone
 
-  // generate blinding factor
-  // B = rm^e mod n
-  rsakpInit(&keypair);
+  if( mpnsetbin(&keypair.e, pkey->e, 4) != 0 ) goto cleanup;
+  if( mpnsetbin(&keypair.dp, pkey->dp, 64) != 0) goto cleanup;
+  if( mpnsetbin(&keypair.dq, pkey->dq, 64) != 0) goto cleanup;
+  if( mpnsetbin(&keypair.qi, pkey->qi, 64) != 0) goto cleanup;
 
-  if( mpnsetbin(&keypair.e, pkey->e, 4) != 0 ) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpnsetbin(&keypair.dp, pkey->dp, 64) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpnsetbin(&keypair.dq, pkey->dq, 64) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpnsetbin(&keypair.qi, pkey->qi, 64) != 0) { CPputs( "FAIL" ); goto cleanup; }
+  if( mpbsetbin(&keypair.n, pkey->n, 128) != 0) goto cleanup;
+  if( mpbsetbin(&keypair.p, pkey->p, 64) != 0) goto cleanup;
+  if( mpbsetbin(&keypair.q, pkey->q, 64) != 0) goto cleanup;
 
-  if( mpbsetbin(&keypair.n, pkey->n, 128) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpbsetbin(&keypair.p, pkey->p, 64) != 0) { CPputs( "FAIL" ); goto cleanup; }
-  if( mpbsetbin(&keypair.q, pkey->q, 64) != 0) { CPputs( "FAIL" ); goto cleanup; }
+  // generate secret blinding factor rb
+  if( getRandom( rb_os ) != 0 ) goto cleanup;
+  if(mpnsetbin(&rb, (byte *) rb_os, (size_t) 16) != 0) goto cleanup;
 
-  mpnzero(&B);
-  if(rsapub(&keypair.n, &keypair.e, &rm, &B)) { CPputs("FAIL"); goto cleanup; }
+  // sign m blinded by rm (for the protocol) and rb (our secret), check the
+  // result against the public key, and take rb back out; what's left,
+  // rm * m^d mod N, is the data to transmit to the AQS
+  if( rsapricrtblind(&keypair, &rm, &rb, &m, &mblind) != 0 ) goto cleanup;
 
-  // blind the data
-  // mblind = B * m mod N
-  mpnzero(&mblind);
-  mpbnmulmod(&keypair.n, &B, &m, &mblind); // oooh this function doesn't even provide error checking :( how much does that suck??
+  if( MP_WORDS_TO_BYTES(mblind.size) != CHAL_SIG_LEN ) goto cleanup;
+  if( i2osp( sig, CHAL_SIG_LEN, mblind.data, mblind.size ) != 0 ) goto cleanup;
 
-  mpnfree(&B); // clear up blinding precursors
-  mpnfree(&m);
+  retval = 0;
 
-  // generate secret blinding factor rb
-  mpnzero(&rb);
-  if( getRandom( rb_os ) != 0 ) { CPputs( "FAIL" ); CPputc( ASCII_EOF ); return; }
-  if(mpnsetbin(&rb, (byte *) rb_os, (size_t) 16) != 0) { CPputs( "FAIL" ); goto cleanup; }
-
-  // generate blinding factor Bprime = rb^e mod N
-  mpnzero(&B);
-  if(rsapub(&keypair.n, &keypair.e, &rb, &B)) { CPputs("FAIL"); goto cleanup; }
-
-  // blind the data again
-  // mSecBlind = Bprime * mblind mod N
-  mpnzero(&mSecBlind);
-  mpbnmulmod(&keypair.n, &B, &mblind, &mSecBlind);
-  mpnfree(&B);
+ cleanup: // dealloc anything that could have been alloc'd...
+  free( m_os ); m_os = NULL;
+  memset(rb_os, 0, sizeof(rb_os));
+  mpnfree(&rb);
+  mpnfree(&rm);
+  mpnfree(&m);
   mpnfree(&mblind);
+  rsakpFree(&keypair);
+  return retval;
+}
 
-  // s = mSecBlind^d mod n
-  mpnzero(&cipher);
+// do the challenge response algorithm
+// peak memory usage @ 2048 bits is 4268 bytes in total heap size
+// x and rn come in already decoded, chalAdmit has been passed
+void chalCore(struct cpResp *r, unsigned short x, octet *rn_os, char userType) {
+  octet    *m_os = NULL;
+  octet rand_oct[16];
+  octet  *cipher_os = NULL;
+  octet sig_os[CHAL_SIG_LEN];
+  unsigned int OKnum;
+  struct chalTranscript transcript;
 
-  if (rsapricrt(&keypair.n, &keypair.p, &keypair.q, &keypair.dp, &keypair.dq, &keypair.qi, &mSecBlind, &cipher )) {
-    CPputs("FAIL");
-    goto cleanup;
-  }
-  mpnfree(&rn);
-  mpnfree(&rm);
-  mpnfree(&pid);
-  mpnfree(&m);    // clean up all precursors
+  chalBufInit(&transcript);
 
-  // compute M' = S^e mod N
-  mpnzero(&m);
-  if(rsapub(&keypair.n, &keypair.e, &cipher, &m)) { CPputs("FAIL"); goto cleanup; }
+  if( x >= MAXKEYS ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  if( setKey(x) == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
 
-  // verify that M' == m
-  if( !mpeq(mSecBlind.size, mSecBlind.data, m.data) ) {
-    mpzero( cipher.size, cipher.data ); // do a wipe and a FAIL
-    CPputs("FAIL"); goto cleanup;  // i suppose just one or the other would do....
-  }
-  // free up the comparison factors m and mSecBlind
-  mpnfree(&m);
-  mpnfree(&mSecBlind);
+  // RESP header
+  respBegin( r, "RESP" );
 
-  // now we need to unblind the data locally...
-  // compute the multiplicative inverse of rb
-  mpnzero(&B);
-  mpninv(&B, &rb, (mpnumber *) &keypair.n);
+  // rm, Paqs(OK), vers, S(rn, rm, x, h(PIDx), Paqs(OK), vers)
+  // 16+ 256+      16+ ..256
+  // generate rm
+  if( getRandom( rand_oct ) != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
 
-  // now perform the unblinding operation
-  mpbnmulmod(&keypair.n, &B, &cipher, &mblind);
-  // the unblinded data to transmit to the AQS is now in mblind
+  // now fetch the encrypted owner key using PAQS
+  // this normally comes pre-computed off the ready-queue, see paqs.c
+  OKnum = getOKnum();
+  cipher_os = calloc(PAQS_LEN, 1);
+  if( cipher_os == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  if( paqsGet(cipher_os, OKnum) != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  // now we are carrying around the PAQS(OK) data...256 extra bytes on the heap!!!
 
-  // finally we are done and can free up all intermediate variables
-  mpnfree(&B);
-  mpnfree(&cipher);
-  mpnfree(&rb);
-  rsakpFree(&keypair);
+  // at this point, do "step 4": assemble message for transmission
+  m_os = calloc(SIGM_OS_SIZE, 1);
+  if( m_os == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  chalMessage(m_os, cipher_os, rand_oct, userType);
+
+  chalBufUpdate(&transcript, m_os, SIGM_OS_SIZE);
+  respData( r, m_os, SIGM_OS_SIZE, NULL );
+  free( m_os ); m_os = NULL;
+
+  if( chalSign(sig_os, x, rn_os, rand_oct, cipher_os) != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  free(cipher_os); cipher_os = NULL;
 
   // now output the data to the AQS
-  cipher_os = calloc(MP_WORDS_TO_BYTES(mblind.size),1);
-  if( cipher_os == NULL ) { CPputs( "FAIL" ); goto cleanup; }
-  if( i2osp( cipher_os, MP_WORDS_TO_BYTES(mblind.size), mblind.data, mblind.size ) != 0 ) {
-    CPputs( "FAIL" );
-    free( cipher_os ); cipher_os = NULL;
-    goto cleanup;
-  }
-  memset(&writer, 0, sizeof(writer));
-  chalBufUpdate(cipher_os, MP_WORDS_TO_BYTES(mblind.size));
-  base64_writer( &writer, cipher_os, MP_WORDS_TO_BYTES(mblind.size), NULL );
-  base64_finish_write(&writer, NULL );
-  free( cipher_os ); cipher_os = NULL;
-  mpnfree(&mblind);
+  chalBufUpdate(&transcript, sig_os, CHAL_SIG_LEN);
+  respData( r, sig_os, CHAL_SIG_LEN, NULL );
 
-  chalBuffFlush();
+  chalBuffFlush(r, &transcript);
 
  cleanup: // dealloc anything that could have been alloc'd...
-  CPputc( ASCII_EOF );
+  respEnd( r );
   free( m_os ); m_os = NULL;
   free( cipher_os ); cipher_os = NULL;
-  free( *kHandle ); *kHandle = NULL;
-  mpnfree(&rb);
-  mpnfree(&rn);
-  mpnfree(&rm);
-  mpnfree(&pid);
-  mpnfree(&m);
-  mpnfree(&cipher);
-  mpnfree(&mblind);
-  mpnfree(&mSecBlind);
-  mpnfree(&B);
-  rsakpFree(&keypair);
+  memset(rand_oct, 0, sizeof(rand_oct));
+  memset(sig_os, 0, sizeof(sig_os));
+  memset(&transcript, 0, sizeof(transcript));
   return;
 }
 
+// one entry of a batched challenge, signed by workersFanOut
+struct chalJob {
+  unsigned short x;
+  const octet   *rn_os;
+  const octet   *rm_os;
+  const octet   *paqs_os;
+  octet          sig[CHAL_SIG_LEN];
+  int            status;
+};
+
+static void chalJobRun(void *arg, unsigned int i) {
+  struct chalJob *job = (struct chalJob *) arg + i;
+  job->status = chalSign(job->sig, job->x, job->rn_os, job->rm_os, job->paqs_os);
+}
+
+/*
+  Batched CHAL: one reply for n (x, rn) pairs.  Everything that doesn't
+  depend on the key is done once and shared by the whole batch -- rm, the
+  PAQS(OK) ciphertext, and the transcript flush -- and the n signatures
+  are computed concurrently by workersFanOut.  The reply is
+    (PAQS(OK), rm, vers), S_0 .. S_n-1 in request order, AES(transcript)
+  so each S_k checks exactly like the signature of a single CHAL with the
+  same rm.  Any failure fails the whole batch.  The caller has already
+  passed chalAdmit for all n.
+*/
+void chalBatch(struct cpResp *r, unsigned int n, unsigned short *x, octet *rn_os, char userType) {
+  struct chalJob *jobs = NULL;
+  octet *m_os = NULL;
+  octet *cipher_os = NULL;
+  octet rand_oct[16];
+  unsigned int i;
+  struct chalTranscript transcript;
+
+  chalBufInit(&transcript);
+
+  if( n == 0 || n > CHLB_MAX ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  for( i = 0; i < n; i++ ) {
+    if( x[i] >= MAXKEYS || setKey(x[i]) == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  }
+
+  respBegin( r, "RESP" );
+
+  if( getRandom( rand_oct ) != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  cipher_os = calloc(PAQS_LEN, 1);
+  if( cipher_os == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  if( paqsGet(cipher_os, getOKnum()) != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+
+  // send the shared part, then sign on this thread and the fan-out helpers
+  m_os = calloc(SIGM_OS_SIZE, 1);
+  if( m_os == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  chalMessage(m_os, cipher_os, rand_oct, userType);
+  chalBufUpdate(&transcript, m_os, SIGM_OS_SIZE);
+  respData( r, m_os, SIGM_OS_SIZE, NULL );
+
+  jobs = calloc(n, sizeof(struct chalJob));
+  if( jobs == NULL ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  for( i = 0; i < n; i++ ) {
+    jobs[i].x = x[i];
+    jobs[i].rn_os = &rn_os[i * 16];
+    jobs[i].rm_os = rand_oct;
+    jobs[i].paqs_os = cipher_os;
+    jobs[i].status = -1;
+  }
+  workersFanOut(chalJobRun, jobs, n);
+
+  for( i = 0; i < n; i++ ) {
+    if( jobs[i].status != 0 ) { respStatus( r, "FAIL", "FAIL" ); goto cleanup; }
+  }
+
+  for( i = 0; i < n; i++ ) {
+    chalBufUpdate(&transcript, jobs[i].sig, CHAL_SIG_LEN);
+    respData( r, jobs[i].sig, CHAL_SIG_LEN, NULL );
+  }
+
+  chalBuffFlush(r, &transcript);
+
+ cleanup:
+  respEnd( r );
+  if( jobs != NULL ) {
+    memset(jobs, 0, n * sizeof(struct chalJob));
+    free(jobs);
+  }
+  free( m_os ); m_os = NULL;
+  free( cipher_os ); cipher_os = NULL;
+  memset(rand_oct, 0, sizeof(rand_oct));
+  memset(&transcript, 0, sizeof(transcript));
+}
+
 // this function outptus the public key specified in *data
 // this is a wrapper function: checks on validity of key
 // index are implemented in outputPublicKey
-void doPkey(char *data, int datLen) {
+void doPkey(struct cpResp *r, char *data, int datLen) {
   unsigned int *kPtr = NULL;
   unsigned int **kHandle = &kPtr;
   unsigned int len = 0;
@@ -800,7 +809,7 @@ void doPkey(char *data, int datLen) {
     free( *kHandle ); *kHandle = NULL;
     return;
   }
-  outputPublicKey((**kHandle) & 0xFFFF);
+  outputPublicKey(r, (**kHandle) & 0xFFFF);
   free( *kHandle ); *kHandle = NULL;
 
   return;
@@ -809,14 +818,11 @@ void doPkey(char *data, int datLen) {
 /*
   Sets the wake-up alarm time
 */
-void doAlarm(char *data, int datLen) {
+void doAlarm(struct cpResp *r, char *data, int datLen) {
   unsigned int *kPtr = NULL;
   unsigned int **kHandle = &kPtr;
   unsigned int len = 0;
-
   unsigned int alarmOffset = 0;
-  unsigned int curTime = 0;
-  FILE *wakealarm;
 
   if(b64decode(data, (void **)kHandle, &len)) { // per ET
     free( *kHandle );
@@ -829,11 +835,19 @@ void doAlarm(char *data, int datLen) {
   alarmOffset = **kHandle;
   free( *kHandle );
 
+  alarmCore(r, alarmOffset);
+}
+
+// alarmOffset is in seconds from now
+void alarmCore(struct cpResp *r, unsigned int alarmOffset) {
+  unsigned int curTime = 0;
+  FILE *wakealarm;
+
   curTime = time(NULL);
   if( (alarmOffset + curTime) < curTime ) {
     // we overflow; don't set the alarm and send a warning message
-    CPputs( "OVFW\n" );
-    CPputc( ASCII_EOF );
+    respStatus( r, "OVFW", "OVFW\n" );
+    respEnd( r );
     return;
   }
   
@@ -842,82 +856,66 @@ void doAlarm(char *data, int datLen) {
   wakealarm = fopen( "/sys/class/rtc/rtc0/wakealarm", "w" );
   if( wakealarm == NULL ) {
     printf( "Can't open /sys/class/rtc/rtc0/wakealarm for writing, aborting alarm set.\n" );
-    CPputs( "OVFW\n" );  // kick out an error condition, albeit inaccurate
-    CPputc( ASCII_EOF );
+    respStatus( r, "OVFW", "OVFW\n" );  // kick out an error condition, albeit inaccurate
+    respEnd( r );
     return;
   }
   fprintf( wakealarm, "%d\n", alarmOffset + curTime );
+  fclose( wakealarm );
 
-  CPputs( "ASET\n" );
-  CPputc( ASCII_EOF );
+  respStatus( r, "ASET", "ASET\n" );
+  respEnd( r );
   return;
 }
 
 
-void sendTime() {
+void sendTime(struct cpResp *r) {
   unsigned long timesecs = time(NULL);
-  struct writer_cb_parm_s writer;
 
-  memset(&writer, 0, sizeof(writer));
-  CPputs( "TIME" );
-  base64_writer( &writer, &timesecs, sizeof(time), NULL );
-  base64_finish_write(&writer, NULL );
-  CPputc( ASCII_EOF );
+  respBegin( r, "TIME" );
+  respData( r, &timesecs, sizeof(time), NULL );
+  respEnd( r );
 }
 
 void sendFail() {
   // for now this is silent. failures communicate information...so don't indicate a failure.
 }
 
-void outputVersion() {
+void outputVersion(struct cpResp *r) {
   unsigned short vers[3] = {0, 0, 0};
-  struct writer_cb_parm_s writer;
 
-  memset(&writer, 0, sizeof(writer));
   vers[2] = MAJOR_VERSION;  // major version
   vers[1] = MINOR_VERSION;  // minor verion
 
-  CPputs( "VRSR" );
-  base64_writer( &writer, vers, sizeof(vers), NULL );
-  base64_finish_write(&writer, NULL );
-  CPputc( ASCII_EOF );
+  respBegin( r, "VRSR" );
+  respData( r, vers, sizeof(vers), NULL );
+  respEnd( r );
 }
 
-void outputSN() {
+void outputSN(struct cpResp *r) {
   struct machDataInFlash *mdat = MACHDATABASE;
-  struct writer_cb_parm_s writer;
-
-  memset(&writer, 0, sizeof(writer));
 
-  CPputs( "SNUM" );
-  base64_writer( &writer, mdat->SN, 16, NULL );
-  base64_finish_write(&writer, NULL );
-  CPputc( ASCII_EOF );
+  respBegin( r, "SNUM" );
+  respData( r, mdat->SN, 16, NULL );
+  respEnd( r );
 }
 
-void outputCurrentOK() {
+void outputCurrentOK(struct cpResp *r) {
   unsigned long OKnum;
-  struct writer_cb_parm_s writer;
 
   OKnum = getOKnum();
-  memset(&writer, 0, sizeof(writer));
-  CPputs( "CKEY" );
+  respBegin( r, "CKEY" );
 
-  base64_writer( &writer, &OKnum, sizeof(OKnum), NULL );
-  base64_finish_write(&writer, NULL );
-  CPputc( ASCII_EOF );
+  respData( r, &OKnum, sizeof(OKnum), NULL );
+  respEnd( r );
 }
 
-void outputHWVersion() {
+void outputHWVersion(struct cpResp *r) {
   struct machDataInFlash *mdat = MACHDATABASE;
-  struct writer_cb_parm_s writer;
-
-  memset(&writer, 0, sizeof(writer));
 
-  CPputs( "HVRS" );
-  base64_writer( &writer, mdat->HWVER, 16, NULL );
-  base64_finish_write(&writer, NULL );
-  CPputc( ASCII_EOF );
+  respBegin( r, "HVRS" );
+  respData( r, mdat->HWVER, 16, NULL );
+  respEnd( r );
 }
 
 #if RAND_ADVL_DBG
@@ -1024,6 +1022,78 @@ static int read_from_eeprom(int file, int addr, char *bytes, int size) {
 
 #define MAXLEN  384
 
+// commands are 4 characters, packed big-endian into an int so the
+// parsers can switch() on them
+#define OPCODE(a,b,c,d)  (((unsigned int)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+#define OP_CHAL  OPCODE('C','H','A','L')
+#define OP_CHUP  OPCODE('C','H','U','P')
+#define OP_CHLB  OPCODE('C','H','L','B')
+#define OP_AUTH  OPCODE('A','U','T','H')
+#define OP_DLK0  OPCODE('D','L','K','0')
+#define OP_DLK1  OPCODE('D','L','K','1')
+#define OP_WIPE  OPCODE('W','I','P','E')
+#define OP_SURE  OPCODE('S','U','R','E')
+#define OP_PKEY  OPCODE('P','K','E','Y')
+#define OP_PIDX  OPCODE('P','I','D','X')
+#define OP_VERS  OPCODE('V','E','R','S')
+#define OP_HWVR  OPCODE('H','W','V','R')
+#define OP_SNUM  OPCODE('S','N','U','M')
+#define OP_CKEY  OPCODE('C','K','E','Y')
+#define OP_ALRM  OPCODE('A','L','R','M')
+#define OP_DOWN  OPCODE('D','O','W','N')
+#define OP_RSET  OPCODE('R','S','E','T')
+#define OP_TIME  OPCODE('T','I','M','E')
+#define OP_STAT  OPCODE('S','T','A','T')
+#define OP_BINF  OPCODE('B','I','N','F')
+#define OP_PIPE  OPCODE('P','I','P','E')
+#define OP_RAND  OPCODE('R','A','N','D')
+#define OP_ADVL  OPCODE('A','D','V','L')
+
+static unsigned int opcode(const char *cmd) {
+  const octet *c = (const octet *) cmd;
+  return OPCODE(c[0], c[1], c[2], c[3]);
+}
+
+// binary framing payload lengths; same octets the text framing base64's
+#define FRAME_CHAL_LEN  18  // x (2 octets, little-endian) followed by rn (16 octets)
+#define FRAME_IDX_LEN   2   // key index, little-endian
+#define FRAME_ALRM_LEN  4   // alarm offset in seconds, little-endian
+
+#define PIPE_DEPTH  8        // max challenges queued on a pipelined connection
+
+// scheduling classes for pipelined requests, highest priority first
+#define PRIO_CHEAP    0      // status queries, answered as soon as they're read
+#define PRIO_USER     1      // CHUP: a human is waiting on it
+#define PRIO_BULK     2      // CHAL, CHLB: background sync traffic
+#define PRIO_CLASSES  3
+
+unsigned int frameSession = 0;   // connection that negotiated BINF or PIPE, 0 if none
+int frameMode = CP_MODE_TEXT;    // framing in use on frameSession
+
+// one framed request
+struct cpReq {
+  char           cmd[4];
+  unsigned short tag;
+  unsigned int   len;            // > MAXLEN means the payload was skipped
+  octet          payload[MAXLEN];
+  int            prio;           // PRIO_*, pipelined requests only
+  unsigned long long arrived;    // monoUs() when it was read
+  unsigned int   runUs;          // time spent computing the reply
+};
+
+struct cpReq *pipeQueue[PIPE_DEPTH];  // pipelined challenges not yet started, in arrival order
+unsigned int pipeCount = 0;
+
+// how long a CHUP may have to wait behind bulk work already on the workers
+unsigned int chupTargetMs = CHUP_TARGET_MS;
+
+// scheduler metrics, reported by STAT
+unsigned int pipeInflight[PRIO_CLASSES];   // on a worker right now
+unsigned int pipeServed[PRIO_CLASSES];     // replies sent
+unsigned int pipeWorstUs[PRIO_CLASSES];    // longest arrival-to-reply time seen
+unsigned int pipeBulkAvgUs = 0;            // running average compute time of a bulk job
+unsigned int pipeRejected = 0;             // challenges turned away BUSY
+
 /*************************************************************************/
 #define ESD_CONFIG_AREA_PART1_OFFSET    0xc000
 // pragma pack() not supported on all platforms, so we make everything dword-aligned using arrays
@@ -1113,6 +1183,451 @@ out:
 }
 
 
+/*
+  Periodic bookkeeping, done once per command rather than once per byte:
+  notes activity for the power-down timer. (The auth counter leaks
+  itself, see chalAdmit.)
+*/
+static void housekeeping() {
+  powerTimer = time(NULL); // update the power-down timer
+}
+
+/*
+  Reads one request frame (see resp.c for the layout). Returns 0 on
+  success, -1 if the connection went away under us.
+*/
+static int readFrame(struct cpReq *q, int mode) {
+  octet hdr[FRAME_TAG_HDR_LEN];
+  octet skip[64];
+  unsigned int i, n;
+
+  if( CPread(hdr, mode == CP_MODE_TAGGED ? FRAME_TAG_HDR_LEN : FRAME_HDR_LEN) )
+    return -1;  // CPread picked up the next connection
+  housekeeping();
+
+  memcpy(q->cmd, hdr, 4);
+  i = 4;
+  if( mode == CP_MODE_TAGGED ) {
+    q->tag = (hdr[i] << 8) | hdr[i+1];
+    i += 2;
+  }
+  q->len = (hdr[i] << 8) | hdr[i+1];
+
+  if( q->len > MAXLEN ) {
+    // bigger than anything we take; skip it so the stream stays in sync
+    for( i = q->len; i > 0; i -= n ) {
+      n = i > sizeof(skip) ? sizeof(skip) : i;
+      if( CPread(skip, n) )
+	return -1;
+    }
+    return 0;
+  }
+  if( q->len && CPread(q->payload, q->len) )
+    return -1;
+  return 0;
+}
+
+// which scheduling class a request falls in; only the cheap ones skip the queue
+static int frameClass(struct cpReq *q) {
+  switch( opcode(q->cmd) ) {
+  case OP_CHUP:
+    return PRIO_USER;
+  case OP_CHAL:
+  case OP_CHLB:
+    return PRIO_BULK;
+  }
+  return PRIO_CHEAP;
+}
+
+// number of signatures a framed challenge asks for, for clientAdmit
+static unsigned int frameCost(struct cpReq *q) {
+  if( opcode(q->cmd) == OP_CHLB && q->len >= FRAME_CHAL_LEN &&
+      q->len / FRAME_CHAL_LEN <= CHLB_MAX )
+    return q->len / FRAME_CHAL_LEN;
+  return 1;
+}
+
+/*
+  The cheap half of a framed CHAL, CHUP or CHLB: length checks, the user
+  present check and the auth counter, all of which stay on the I/O
+  thread. Returns 0 if frameChal may go ahead, otherwise r holds the
+  status to send.
+*/
+static int frameAdmit(struct cpResp *r, struct cpReq *q) {
+  unsigned int len = q->len;
+
+  switch( opcode(q->cmd) ) {
+  case OP_CHAL:
+    if( len != FRAME_CHAL_LEN )
+      break;
+    return chalAdmit(r, CHAL_NOUSER, 1);
+  case OP_CHUP:
+    if( len != FRAME_CHAL_LEN )
+      break;
+    if( !userPresent ) {
+      respStatus( r, "USER", "USER\n" );
+      return -1;
+    }
+    userPresent = 0; // don't forget to remove it!!!
+    return chalAdmit(r, CHAL_REQUSER, 1);
+  case OP_CHLB:
+    // batched CHAL, frame only: up to CHLB_MAX back-to-back (x, rn) pairs
+    if( len == 0 || len % FRAME_CHAL_LEN != 0 || len / FRAME_CHAL_LEN > CHLB_MAX )
+      break;
+    return chalAdmit(r, CHAL_NOUSER, len / FRAME_CHAL_LEN);
+  }
+  respStatus( r, "FAIL", "FAIL" );
+  return -1;
+}
+
+// the expensive half, run inline or on a crypto worker
+static void frameChal(struct cpResp *r, struct cpReq *q) {
+  octet *payload = q->payload;
+  unsigned short bx[CHLB_MAX];
+  octet brn[CHLB_MAX * 16];
+  unsigned int i, n;
+
+  switch( opcode(q->cmd) ) {
+  case OP_CHAL:
+    chalCore(r, payload[0] | (payload[1] << 8), &payload[2], CHAL_NOUSER);
+    break;
+  case OP_CHUP:
+    chalCore(r, payload[0] | (payload[1] << 8), &payload[2], CHAL_REQUSER);
+    break;
+  case OP_CHLB:
+    n = q->len / FRAME_CHAL_LEN;
+    for( i = 0; i < n; i++ ) {
+      bx[i] = payload[i * FRAME_CHAL_LEN] | (payload[i * FRAME_CHAL_LEN + 1] << 8);
+      memcpy(&brn[i * 16], &payload[i * FRAME_CHAL_LEN + 2], 16);
+    }
+    chalBatch(r, n, bx, brn, CHAL_NOUSER);
+    memset(brn, 0, sizeof(brn));
+    break;
+  }
+}
+
+static void frameJob(struct cpJob *job) {
+  struct cpReq *q = job->arg;
+  unsigned long long start = monoUs();
+
+  frameChal(&job->resp, q);
+  q->runUs = monoUs() - start;
+}
+
+/*
+  Answers one framed request with exactly one frame. Requests are decoded
+  straight into the arguments of the command cores; there's no base64 on
+  either side.
+*/
+static void runFrame(struct cpReq *q, int mode) {
+  struct cpResp resp;
+  octet *payload = q->payload;
+  unsigned int len = q->len;
+
+  respInit(&resp, mode, q->cmd);
+  resp.tag = q->tag;
+
+  if( len > MAXLEN ) {
+    respStatus( &resp, "FAIL", "FAIL" );
+    respEnd( &resp );
+    return;
+  }
+
+  switch( opcode(q->cmd) ) {
+  case OP_CHAL:
+  case OP_CHUP:
+  case OP_CHLB:
+    if( clientAdmit(&resp, frameCost(q)) != 0 )
+      break;
+    if( frameAdmit(&resp, q) == 0 )
+      frameChal(&resp, q);
+    else
+      clientRefund(frameCost(q));
+    break;
+  case OP_PKEY:
+    if( len != FRAME_IDX_LEN )
+      goto badFrame;
+    outputPublicKey(&resp, payload[0] | (payload[1] << 8));
+    break;
+  case OP_PIDX:
+    if( len != FRAME_IDX_LEN )
+      goto badFrame;
+    pidxCore(&resp, payload[0] | (payload[1] << 8));
+    break;
+  case OP_ALRM:
+    if( len != FRAME_ALRM_LEN )
+      goto badFrame;
+    alarmCore(&resp, payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((unsigned int) payload[3] << 24));
+    break;
+  case OP_VERS:
+    outputVersion(&resp);
+    break;
+  case OP_HWVR:
+    outputHWVersion(&resp);
+    break;
+  case OP_SNUM:
+    outputSN(&resp);
+    break;
+  case OP_CKEY:
+    outputCurrentOK(&resp);
+    break;
+  case OP_TIME:
+    sendTime(&resp);
+    break;
+  case OP_STAT:
+    outputStats(&resp);
+    break;
+  case OP_DOWN:
+    printf( "Issuing /sbin/poweroff command, system going down...\n" );
+    system("/sbin/poweroff");
+    return;  // no reply, same as the text framing
+  case OP_RSET:
+    return;
+  default:
+  badFrame:
+    // unknown, malformed, or not supported in binary mode (AUTH, DLK0/1, WIPE)
+    respStatus( &resp, "FAIL", "FAIL" );
+    break;
+  }
+
+  respEnd( &resp );  // every frame gets exactly one answer
+}
+
+// book-keeping for a pipelined request whose reply just went out
+static void pipeDone(struct cpReq *q) {
+  unsigned long long waited = monoUs() - q->arrived;
+
+  pipeServed[q->prio]++;
+  if( waited > pipeWorstUs[q->prio] )
+    pipeWorstUs[q->prio] = waited;
+  if( q->prio == PRIO_BULK && q->runUs != 0 ) {
+    if( pipeBulkAvgUs == 0 )
+      pipeBulkAvgUs = q->runUs;
+    else
+      pipeBulkAvgUs = pipeBulkAvgUs - pipeBulkAvgUs / 8 + q->runUs / 8;
+  }
+}
+
+/*
+  Sends the replies the crypto workers have finished, dropping any for a
+  client that has since gone away.
+*/
+static void pipeReap() {
+  struct cpJob *job;
+  struct cpReq *q;
+
+  while( (job = workersDone()) != NULL ) {
+    q = job->arg;
+    pipeInflight[q->prio]--;
+    if( job->session == CPsession() ) {
+      respFlush(&job->resp, 1);
+      pipeDone(q);
+    } else {
+      respFlush(&job->resp, 0);
+    }
+    memset(job->arg, 0, sizeof(struct cpReq));
+    free(job->arg);
+    free(job);
+  }
+}
+
+// drop everything queued for a pipelined connection
+static void pipeFlush() {
+  pipeReap();
+  while( pipeCount > 0 ) {
+    pipeCount--;
+    memset(pipeQueue[pipeCount], 0, sizeof(struct cpReq));
+    free(pipeQueue[pipeCount]);
+    pipeQueue[pipeCount] = NULL;
+  }
+}
+
+/*
+  Picks the next queued challenge to start: the oldest CHUP if there is
+  one, else the oldest bulk challenge -- as long as putting it on a
+  worker keeps a CHUP that shows up next within chupTargetMs of being
+  started.  Each worker may always have one bulk job, or nothing would
+  ever get done.  Returns -1 if nothing should start yet.
+*/
+static int pipePick() {
+  unsigned int i;
+  unsigned long long backlog;
+
+  for( i = 0; i < pipeCount; i++ ) {
+    if( pipeQueue[i]->prio == PRIO_USER )
+      return i;
+  }
+  if( pipeCount == 0 )
+    return -1;
+  if( !workersRunning() || pipeInflight[PRIO_BULK] < workersRunning() )
+    return 0;
+  if( pipeBulkAvgUs == 0 )
+    return -1;  // no idea how long they take yet, wait for one to finish
+  backlog = (unsigned long long) (pipeInflight[PRIO_BULK] + 1) * pipeBulkAvgUs / workersRunning();
+  return backlog <= (unsigned long long) chupTargetMs * 1000 ? 0 : -1;
+}
+
+/*
+  Starts queued challenge pick: admitted here, then computed on a crypto
+  worker, or right here if there are none.  With workers the caller
+  makes sure one has room.
+*/
+static void pipeDispatch(int pick) {
+  struct cpReq *q = pipeQueue[pick];
+  struct cpJob *job = NULL;
+  struct cpResp resp;
+  unsigned long long start;
+  unsigned int i;
+
+  for( i = pick; i + 1 < pipeCount; i++ )
+    pipeQueue[i] = pipeQueue[i+1];
+  pipeQueue[--pipeCount] = NULL;
+
+  // clientAdmit was charged when it was queued, and the queue is
+  // dropped with the connection, so this is still the same client
+  respInit(&resp, CP_MODE_TAGGED, q->cmd);
+  resp.tag = q->tag;
+  if( frameAdmit(&resp, q) != 0 ) {
+    clientRefund(frameCost(q));
+    respEnd(&resp);  // refused; that answer can go out right away
+    goto done;
+  }
+
+  if( workersRunning() )
+    job = calloc(1, sizeof(struct cpJob));
+  if( job == NULL ) {
+    start = monoUs();
+    frameChal(&resp, q);
+    respEnd(&resp);
+    q->runUs = monoUs() - start;
+    goto done;
+  }
+
+  job->resp = resp;
+  job->resp.deferred = 1;
+  job->run = frameJob;
+  job->arg = q;
+  job->session = CPsession();
+  if( workersSubmit(job) != 0 ) {  // shouldn't happen, the caller checked
+    frameJob(job);
+    respFlush(&job->resp, 1);
+    free(job);
+    goto done;
+  }
+  pipeInflight[q->prio]++;
+  return;
+
+ done:
+  pipeDone(q);
+  memset(q, 0, sizeof(struct cpReq));
+  free(q);
+}
+
+/*
+  Pipelined mode: the client may have several tagged requests in flight.
+  Cheap requests are answered as soon as they're read; challenges are
+  queued (up to PIPE_DEPTH, beyond which they're answered BUSY on the
+  spot, as are those over the client's rate) and handed to the crypto workers, CHUPs ahead of bulk CHALs
+  (see pipePick), so a VERS or TIME sent behind a stack of CHALs doesn't
+  wait for any of them and a CHUP waits for as few as possible.
+  Finished challenges are sent back as they come in.  Without workers,
+  queued challenges run here one per pass, with the socket checked for
+  cheap requests in between.
+*/
+static void doPipeline() {
+  struct cpReq *q;
+  struct cpResp resp;
+  int ev, pick, n;
+
+  pipeReap();
+
+  while( !workersFull() && (pick = pipePick()) >= 0 ) {
+    pipeDispatch(pick);
+    if( !workersRunning() )
+      break;
+  }
+
+  // wait for a request or a finished challenge
+  ev = CPwait(1, workersWakeFd(), (pipeCount > 0 && !workersRunning()) ? 0 : -1);
+  if( !(ev & CP_WAIT_INPUT) )
+    return;
+
+  n = 0;
+  do {
+    q = calloc(1, sizeof(struct cpReq));
+    if( q == NULL )
+      break;
+    if( readFrame(q, CP_MODE_TAGGED) ) {
+      free(q);
+      pipeFlush();  // the client that sent these is gone
+      return;
+    }
+    q->arrived = monoUs();
+    q->prio = frameClass(q);
+    if( q->prio != PRIO_CHEAP ) {
+      // admission: turn the challenge away now, before any of it is
+      // decoded, if the queue is full or this client is over its rate
+      respInit(&resp, CP_MODE_TAGGED, q->cmd);
+      resp.tag = q->tag;
+      if( pipeCount >= PIPE_DEPTH ) {
+	respStatus( &resp, "BUSY", "BUSY\n" );
+	respEnd( &resp );
+      } else if( clientAdmit(&resp, frameCost(q)) == 0 ) {
+	pipeQueue[pipeCount++] = q;
+	continue;
+      }
+      pipeRejected++;
+      pipeDone(q);
+      memset(q, 0, sizeof(struct cpReq));
+      free(q);
+    } else {
+      runFrame(q, CP_MODE_TAGGED);
+      pipeDone(q);
+      memset(q, 0, sizeof(struct cpReq));
+      free(q);
+    }
+  } while( ++n < PIPE_DEPTH && CPpoll(0) > 0 );  // bounded, so a flood can't starve the workers
+}
+
+/*
+  Reports the pipelined scheduler's state: for each class (cheap, user,
+  bulk) the number queued, on a worker, and served so far, and the worst
+  arrival-to-reply time in microseconds; then the running average bulk
+  compute time (us), the CHUP latency target (ms) and the number of
+  challenges turned away BUSY.  All big-endian 32-bit.
+*/
+void outputStats(struct cpResp *r) {
+  octet stats[(PRIO_CLASSES * 4 + 3) * 4];
+  unsigned int queued[PRIO_CLASSES];
+  unsigned int v[PRIO_CLASSES * 4 + 3];
+  unsigned int i, n;
+
+  memset(queued, 0, sizeof(queued));
+  for( i = 0; i < pipeCount; i++ )
+    queued[pipeQueue[i]->prio]++;
+
+  n = 0;
+  for( i = 0; i < PRIO_CLASSES; i++ ) {
+    v[n++] = queued[i];
+    v[n++] = pipeInflight[i];
+    v[n++] = pipeServed[i];
+    v[n++] = pipeWorstUs[i];
+  }
+  v[n++] = pipeBulkAvgUs;
+  v[n++] = chupTargetMs;
+  v[n++] = pipeRejected;
+  for( i = 0; i < n; i++ ) {
+    stats[i*4]   = (v[i] >> 24) & 0xFF;
+    stats[i*4+1] = (v[i] >> 16) & 0xFF;
+    stats[i*4+2] = (v[i] >> 8) & 0xFF;
+    stats[i*4+3] = v[i] & 0xFF;
+  }
+
+  respBegin( r, "STAT" );
+  respData( r, stats, sizeof(stats), NULL );
+  respEnd( r );
+}
+
 void crypto(char *keyfile_name) {
   char cmd[4];
   char *data = NULL;
@@ -1120,9 +1635,13 @@ void crypto(char *keyfile_name) {
   unsigned int index = 0;
   unsigned int datIndex = 0;
   ParserState state = PARSE_CMD;
+  struct cpResp resp;
   char c;
-  unsigned int authRatio;
-  int authDiff;
+  char *inbuf;
+  char *bang;
+  int avail, inpos, run;
+  int switched;
+  unsigned int sess;
   struct machDataInFlash mdf;
   struct privKeyInFlash pkf[MAXKEYS];
 
@@ -1172,32 +1691,16 @@ void crypto(char *keyfile_name) {
   MACHDATABASE = &mdf;
   KEYBASE = &(pkf[0]);
 
-  lastAuthTime = 0;
+  // start filling the PAQS(OK) ready-queue in the background
+  paqsStart();
+  workersStart();
+
+  memset(&authBucket, 0, sizeof(authBucket));
+  memset(&chupBucket, 0, sizeof(chupBucket));
   powerTimer = 0;
 
   index = 0;
   while(1) {
-    // manage the authorization count
-    if( (time(NULL) - lastAuthTime) > AUTH_INTERVAL_SECS ) {
-      // grab the ratio, because we can sleep for a very long time before we update
-      // this netx line of code is always guaranteed to be greater than 1
-      // by virtue of the if statement above
-      authRatio = (time(NULL) - lastAuthTime) / AUTH_INTERVAL_SECS;
-
-      // update the lastAuthTime
-      lastAuthTime = time(NULL);
-
-      // make sure we don't try to subtract too much from authCount
-      if( authRatio > authCount )
-	authRatio = authCount;
-      // if authCount > 0 then subtract out the authRatio...
-      if( authCount > 0 ) {
-	authCount -= authRatio;
-      }
-      if( authCount > AUTH_MAX_AUTHS )  // just some paranoia
-	authCount = AUTH_MAX_AUTHS;
-    }
-
 #if POLLED_MODE
     // first check the state of the reset request
     if( GPIO_ReadInputDataBit(GPIO_POWERSWITCH) ) {
@@ -1235,10 +1738,27 @@ void crypto(char *keyfile_name) {
         //	cmdPowerDown();
         //      }
 
-      // grab a character
-      
-      c = CPgetc();
-      powerTimer = time(NULL); // update the power-down timer
+      // a connection that negotiated BINF or PIPE talks in frames from here on
+      if( frameSession != 0 && frameSession == CPsession() ) {
+	if( frameMode == CP_MODE_TAGGED ) {
+	  doPipeline();
+	} else {
+	  struct cpReq q;
+	  if( readFrame(&q, CP_MODE_FRAMED) == 0 )
+	    runFrame(&q, CP_MODE_FRAMED);
+	  memset(&q, 0, sizeof(q));
+	}
+	continue;
+      }
+      pipeFlush();  // leftovers from a pipelined client that hung up
+
+      // grab whatever the host has sent so far, and run all of it
+      // through the parser before going back to the socket
+      avail = CPpeek(&inbuf);
+      sess = CPsession();
+      switched = 0;
+      for( inpos = 0; inpos < avail; inpos++ ) {
+      c = inbuf[inpos];
       if( c == '!' ) { // synchronize the stream to '!' character
 	CPputc('?'); // rise and shine, let the host know we are awake now.
 	//	printf( "." ); fflush(stdout);
@@ -1258,8 +1778,10 @@ void crypto(char *keyfile_name) {
         index++;
         if( index == 4 ) {
           // parse the command
+	  housekeeping();  // once per command, not once per byte
 	  expectedLen = 0;  // invariant: expectedLen is 0 unless otherwise spec'd by cmd
 	  datIndex = 0;
+	  respInit(&resp, CP_MODE_TEXT, cmd);
 #if 0
 	  {
 	    char cmd2[5];
@@ -1271,75 +1793,104 @@ void crypto(char *keyfile_name) {
 	    fflush(stdout);
 	  }
 #endif
-          if( 0 == strncmp("CHAL", cmd, 4) ) {  // CHAL packet
+	  switch( opcode(cmd) ) {
+	  case OP_CHAL:  // CHAL packet
             state = PARSE_DAT;
             expectedLen = CHAL_DATLEN;
-          } else if( 0 == strncmp("CHUP", cmd, 4 ) ) { // CHUP packet
+	    break;
+	  case OP_CHUP:  // CHUP packet
 	    state = PARSE_DAT;
 	    expectedLen = CHUP_DATLEN;
-	  } else if( 0 == strncmp("AUTH", cmd, 4)) { // AUTH packet
+	    break;
+	  case OP_AUTH:  // AUTH packet
             state = PARSE_DAT;
             expectedLen = AUTH_DATLEN;
-          } else if( 0 == strncmp("DLK0", cmd, 4)) {
+	    break;
+	  case OP_DLK0:
             state = PARSE_DAT;
             expectedLen = DLK0_DATLEN;
-          } else if( 0 == strncmp("DLK1", cmd, 4)) {
+	    break;
+	  case OP_DLK1:
             state = PARSE_DAT;
             expectedLen = DLK1_DATLEN;
-          } else if( 0 == strncmp("WIPE", cmd, 4)) {
+	    break;
+	  case OP_WIPE:
 	    state = PARSE_WIPE;
 	    cmd[0] = '\0'; cmd[1] = '\0'; cmd[2] = '\0'; cmd[3] = '\0';
 	    index = 0;
 	    CPputs( "WARNING: UNLOCK STAGE 1 PASSED.\n" );
 	    CPputc( ASCII_EOF );
-          } else if( 0 == strncmp("SURE", cmd, 4)) {
+	    break;
+	  case OP_SURE:
 	    CPputs( "UNLOCK STAGE 2 FAILED.\n" );
 	    CPputc( ASCII_EOF );
 	    goto abortParse;  // we should never get SURE without a previous WIPE
-          } else if( 0 == strncmp("PKEY", cmd, 4)) {
+	  case OP_PKEY:
 	    printf( "pkey\n" );
             state = PARSE_DAT;
             expectedLen = PKEY_DATLEN;
-          } else if( 0 == strncmp("PIDX", cmd, 4)) {
+	    break;
+	  case OP_PIDX:
             state = PARSE_DAT;
             expectedLen = PKEY_DATLEN;
-          } else if( 0 == strncmp("VERS", cmd, 4)) {
-	    outputVersion();
+	    break;
+	  case OP_VERS:
+	    outputVersion(&resp);
 	    goto resetParse;
-          } else if( 0 == strncmp("HWVR", cmd, 4)) {
-	    outputHWVersion();
+	  case OP_HWVR:
+	    outputHWVersion(&resp);
 	    goto resetParse;
-          } else if( 0 == strncmp("SNUM", cmd, 4)) {
-	    outputSN();
+	  case OP_SNUM:
+	    outputSN(&resp);
 	    goto resetParse;
-          } else if( 0 == strncmp("CKEY", cmd, 4)) {
-	    outputCurrentOK();
+	  case OP_CKEY:
+	    outputCurrentOK(&resp);
 	    goto resetParse;
-          } else if( 0 == strncmp("ALRM", cmd, 4)) {
+	  case OP_ALRM:
             state = PARSE_DAT;
             expectedLen = ALRM_DATLEN;
-          } else if( 0 == strncmp("DOWN", cmd, 4)) {
+	    break;
+	  case OP_DOWN:
 	    printf( "Issuing /sbin/poweroff command, system going down...\n" );
 	    system("/sbin/poweroff");
             // power down the chumby
             // cmdPowerDown();
             goto resetParse;
-          } else if( 0 == strncmp("RSET", cmd, 4)) {
+	  case OP_RSET:
             // reset the chumby
             // cmdReset();
             goto resetParse;
-          } else if( 0 == strncmp("TIME", cmd, 4)) {
-	    sendTime();
+	  case OP_TIME:
+	    sendTime(&resp);
+	    goto resetParse;
+	  case OP_STAT:
+	    outputStats(&resp);
+	    goto resetParse;
+	  case OP_BINF:
+	    // switch this connection over to length-prefixed binary frames
+	    CPputs( "BINF" );
+	    CPputc( ASCII_EOF );
+	    frameSession = CPsession();
+	    frameMode = CP_MODE_FRAMED;
+	    switched = 1;
+	    goto resetParse;
+	  case OP_PIPE:
+	    // switch this connection over to tagged, pipelined frames
+	    CPputs( "PIPE" );
+	    CPputc( ASCII_EOF );
+	    frameSession = CPsession();
+	    frameMode = CP_MODE_TAGGED;
+	    switched = 1;
 	    goto resetParse;
 #if RAND_ADVL_DBG
-	  } else if( 0 == strncmp("RAND", cmd, 4)) {
+	  case OP_RAND:
 	    testRandom();
 	    goto resetParse;
-          } else if( 0 == strncmp("ADVL", cmd, 4)) {
+	  case OP_ADVL:
             printADC();
             goto resetParse;
 #endif
-	  } else {
+	  default:
             goto abortParse;
           }
 	  // here we should have a command, and the state should have moved
@@ -1363,8 +1914,17 @@ void crypto(char *keyfile_name) {
 
       case PARSE_DAT:
 	if( datIndex < expectedLen ) {
-	  data[datIndex] = c;
-	  datIndex++;
+	  // take as much of the payload as this buffer holds in one go,
+	  // stopping short of a '!' so the sync check above still sees it
+	  run = expectedLen - datIndex;
+	  if( run > avail - inpos )
+	    run = avail - inpos;
+	  bang = memchr(&inbuf[inpos], '!', run);
+	  if( bang != NULL )
+	    run = bang - &inbuf[inpos];
+	  memcpy(&data[datIndex], &inbuf[inpos], run);
+	  datIndex += run;
+	  inpos += run - 1;
 	} else {
           data[datIndex] = '\0'; // cap the command here, where we hit our expected length...
 	  state = PARSE_END;
@@ -1377,17 +1937,21 @@ void crypto(char *keyfile_name) {
 	  goto abortParse;
 	}
 	// ok, we had a well-formed input string. Let's do something with it now.
-	if( 0 == strncmp("CHAL", cmd, 4) ) {  // CHAL packet
-	  doChal(data, datIndex, CHAL_NOUSER);  
-	} else if( 0 == strncmp("CHUP", cmd, 4 )) {
+	respInit(&resp, CP_MODE_TEXT, cmd);
+	switch( opcode(cmd) ) {
+	case OP_CHAL:  // CHAL packet
+	  doChal(&resp, data, datIndex, CHAL_NOUSER);  
+	  break;
+	case OP_CHUP:
 	  if( userPresent ) {
-	    doChal(data, datIndex, CHAL_REQUSER);  
+	    doChal(&resp, data, datIndex, CHAL_REQUSER);  
 	    userPresent = 0; // don't forget to remove it!!!
 	  } else { 
-	    CPputs( "USER\n" );  // indicate that the user was not present at time of transaction request
-	    CPputc( ASCII_EOF );
+	    respStatus( &resp, "USER", "USER\n" );  // indicate that the user was not present at time of transaction request
+	    respEnd( &resp );
 	  }
-	} else if( 0 == strncmp("DLK0", cmd, 4)) {
+	  break;
+	case OP_DLK0:
 	  keyLen = 0; // per ET
 	  if(b64decode(data, (void **)keyHandle, &keyLen)) { // per ET
 	    free( *keyHandle ); *keyHandle = NULL;  // key handle got malloc'd...
@@ -1408,7 +1972,7 @@ void crypto(char *keyfile_name) {
 	  free(data); data = NULL;
 //	  setStopMode();
 	  continue;  // this is important because it prevents a resetParse at the bottom of clause
-	} else if( 0 == strncmp("DLK1", cmd, 4)) {
+	case OP_DLK1:
 	  if( !lastWasDLK0 )
 	    goto abortParse;
 	  keyLen = 0;  // per ET
@@ -1427,14 +1991,17 @@ void crypto(char *keyfile_name) {
 	  // eraseKey(keyCandidate);
 	  free( *keyHandle ); *keyHandle = NULL;
 	  goto resetParse;
-	} else if( 0 == strncmp("PKEY", cmd, 4)) {
+	case OP_PKEY:
 	  printf( "pkey2\n" );
-	  doPkey(data, datIndex);
-	} else if( 0 == strncmp("PIDX", cmd, 4)) {
-	  doPidx(data, datIndex);
-	} else if( 0 == strncmp("ALRM", cmd, 4)) {
-	  doAlarm(data, datIndex);
-	} else {
+	  doPkey(&resp, data, datIndex);
+	  break;
+	case OP_PIDX:
+	  doPidx(&resp, data, datIndex);
+	  break;
+	case OP_ALRM:
+	  doAlarm(&resp, data, datIndex);
+	  break;
+	default:
 	  goto resetParse;
 	}
 	// clean up.
@@ -1471,6 +2038,14 @@ void crypto(char *keyfile_name) {
 	keyCandidate = 0xFFFFFFFF;
         free(data); data = NULL;
       } // switch
+      if( switched ) { // the rest of the buffer is frames, leave it for readFrame
+	inpos++;
+	break;
+      }
+      if( CPsession() != sess )
+	break;  // the client went away mid-reply, and the rest of its input with it
+      } // for each buffered character
+      CPconsume(inpos);
 #if POLLED_MODE
     } // else on the parse
 #endif
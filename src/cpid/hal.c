@@ -19,6 +19,8 @@
 #include <sys/un.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <poll.h>
+#include <string.h>
 
 
 // these variables comes from crypto.c
@@ -27,6 +29,20 @@ extern unsigned char powerState;
 static int io_initialized = 0;
 static int socket_file    = 0;
 static int current_socket = 0;
+static unsigned int session = 0;  // bumped on every new connection
+
+// input is read from the socket in blocks and parsed out of this buffer
+#define INBUF_SIZE 512
+static char inBuf[INBUF_SIZE];
+static int inHead = 0;            // next byte to hand out
+static int inTail = 0;            // one past the last byte read
+static unsigned int inSession = 0;  // connection the last CPpeek looked at
+
+// between CPhold and CPflush, output is collected here and written in one go
+#define OUTBUF_SIZE 1024
+static char outBuf[OUTBUF_SIZE];
+static int outLen = 0;
+static int outHeld = 0;
 
 static int CP_initialize_io(const char *socket_name) {
     int temp_socket;
@@ -120,34 +136,65 @@ static void CP_accept_new_connection() {
     if(current_socket)
         close(current_socket);
     current_socket = new_socket;
+    session++;
+    inHead = inTail = 0;  // whatever the last client left unread is dropped
 
     return;
 }
 
 
-unsigned char CPgetc() {
-    char c;
+// Tops up the input buffer with whatever the socket has, blocking if it
+// has nothing. Returns -1 (having picked up the next connection) if the
+// client has gone away.
+static int CP_fill() {
+    int got;
+
     if(!current_socket)
         CP_accept_new_connection();
 
-    //read 1 char @ a time from stdin
-    if(1!=read(current_socket,&c,1)) {
+    if(inHead == inTail)
+        inHead = inTail = 0;
+    while(1) {
+        got = read(current_socket, inBuf + inTail, INBUF_SIZE - inTail);
+        if(got > 0)
+            break;
+        if(got < 0 && errno == EINTR)
+            continue;
         // Not being able to read probably indicates the other side of the
         // connection has closed.  Attempt to make a new connection.
-//        perror("Unable to read"); 
         CP_accept_new_connection();
-        if(1!=read(current_socket,&c,1)) {
-            perror("Unable to read character, so dropped");
-            return c;
-        }
+        return -1;
     }
+    inTail += got;
+    return 0;
+}
 
-    // Write the character back.  This has the side-effect of flushing the
-    // buffer.
-//    write(current_socket, &c, 1);
+unsigned char CPgetc() {
+    while(inHead == inTail)
+        CP_fill();
+    return inBuf[inHead++];
+}
 
+// Hands the caller everything buffered so far (blocking until there is at
+// least one byte) without consuming it; the caller says how much it used
+// with CPconsume.
+int CPpeek( char **p ) {
+    while(inHead == inTail)
+        CP_fill();
+    inSession = session;
+    *p = inBuf + inHead;
+    return inTail - inHead;
+}
 
-    return c;
+// Marks n bytes from the last CPpeek as used. If the connection changed in
+// the meantime (a write failed and we accepted a new client), the buffer
+// already belongs to someone else and there's nothing to consume.
+void CPconsume( int n ) {
+    if(inSession != session)
+        return;
+    inHead += n;
+    if(inHead >= inTail)
+        inHead = inTail = 0;
 }
 
 int CPputs( char *str ) {
@@ -160,6 +207,14 @@ int CPputs( char *str ) {
 
 int CPputc( char c ) {
   //  printf( "%c", c ); fflush(stdout);
+    if(outHeld) {
+        if(outLen == OUTBUF_SIZE) {
+            CPflush();
+            outHeld = 1;
+        }
+        outBuf[outLen++] = c;
+        return (1);
+    }
     if(!io_initialized)
         CP_accept_new_connection();
     if(1!=write(current_socket, &c, 1)) {
@@ -180,6 +235,170 @@ int CPputc( char c ) {
     return (1);
 }
 
+// Collects output from CPputc/CPputs instead of writing it a character
+// at a time, until CPflush.
+void CPhold() {
+    outHeld = 1;
+}
+
+// Writes out everything collected since CPhold with as few writes as the
+// socket allows, and goes back to writing straight through. Like CPputc,
+// if the client has gone away the rest goes to whoever connects next.
+void CPflush() {
+    char *p = outBuf;
+    int len = outLen;
+    int put, retried = 0;
+
+    outHeld = 0;
+    outLen = 0;
+    if(len == 0)
+        return;
+    if(!io_initialized)
+        CP_accept_new_connection();
+
+    while(len > 0) {
+        put = write(current_socket, p, len);
+        if(put <= 0) {
+            if(put < 0 && errno == EINTR)
+                continue;
+            if(retried) {
+                perror("Tried again and failed, so dropped output");
+                break;
+            }
+            CP_accept_new_connection();
+            retried = 1;
+            continue;
+        }
+        p   += put;
+        len -= put;
+    }
+    memset(outBuf, 0, sizeof(outBuf));
+}
+
+// Identifies the current connection, so per-connection protocol state
+// (like binary framing) can be dropped when the client goes away.
+unsigned int CPsession() {
+    return session;
+}
+
+// Microseconds since some fixed point, unaffected by changes to the
+// wall clock; for measuring intervals only.
+unsigned long long monoUs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Reads exactly len bytes. Unlike CPgetc, a short read does not carry on
+// with the next connection, since a frame can't span two clients: we pick
+// up the new connection and return -1 so the caller drops the frame.
+int CPread( void *buf, int len ) {
+    char *p = buf;
+    int got;
+
+    if(!current_socket)
+        CP_accept_new_connection();
+
+    // anything already buffered comes first
+    got = inTail - inHead;
+    if(got > len)
+        got = len;
+    memcpy(p, inBuf + inHead, got);
+    inHead += got;
+    p   += got;
+    len -= got;
+
+    while(len > 0) {
+        got = read(current_socket, p, len);
+        if(got <= 0) {
+            if(got < 0 && errno == EINTR)
+                continue;
+            CP_accept_new_connection();
+            return -1;
+        }
+        p   += got;
+        len -= got;
+    }
+    return 0;
+}
+
+// Writes exactly len bytes to the current connection. A failed write is
+// dropped; the next read will notice the connection is gone.
+int CPwrite( const void *buf, int len ) {
+    const char *p = buf;
+    int put;
+
+    if(!io_initialized)
+        CP_accept_new_connection();
+
+    while(len > 0) {
+        put = write(current_socket, p, len);
+        if(put <= 0) {
+            if(put < 0 && errno == EINTR)
+                continue;
+            perror("Unable to write, dropped frame");
+            return -1;
+        }
+        p   += put;
+        len -= put;
+    }
+    return 0;
+}
+
+// Returns >0 if there is input waiting on the current connection within
+// timeout_ms (0 = just check, -1 = wait), 0 if not, <0 on error.
+int CPpoll( int timeout_ms ) {
+    struct pollfd pfd;
+
+    if(inHead != inTail)
+        return 1;
+    if(!current_socket)
+        return 0;
+
+    pfd.fd = current_socket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout_ms);
+}
+
+// Waits up to timeout_ms for input on the current connection (if
+// want_input) and/or for fd to become readable (if fd >= 0). Returns a
+// mask of CP_WAIT_INPUT and CP_WAIT_FD, 0 on timeout.
+int CPwait( int want_input, int fd, int timeout_ms ) {
+    struct pollfd pfd[2];
+    int n = 0, ret = 0;
+
+    if(want_input && (inHead != inTail || !current_socket))
+        return CP_WAIT_INPUT;  // buffered already, or CPread will accept a client
+
+    if(want_input) {
+        pfd[n].fd = current_socket;
+        pfd[n].events = POLLIN;
+        pfd[n].revents = 0;
+        n++;
+    }
+    if(fd >= 0) {
+        pfd[n].fd = fd;
+        pfd[n].events = POLLIN;
+        pfd[n].revents = 0;
+        n++;
+    }
+    if(n == 0)
+        return 0;
+
+    while(poll(pfd, n, timeout_ms) < 0) {
+        if(errno != EINTR)
+            return 0;
+    }
+    n = 0;
+    if(want_input && pfd[n++].revents)
+        ret |= CP_WAIT_INPUT;  // hangups too, so CPread notices them
+    if(fd >= 0 && pfd[n].revents)
+        ret |= CP_WAIT_FD;
+    return ret;
+}
+
 #if 0
 /*************************************************************************/
 // this function attempts to wait the number of ms specified by the passed arg
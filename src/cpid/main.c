@@ -7,11 +7,14 @@
 
 void print_help(char *name) {
     printf("Usage:\n"
-            "    %s [-hd] -k [keyfile]\n"
+            "    %s [-hd] [-u ms] [-o otpkeyfile] -k [keyfile]\n"
             "   -k [keyfile]        Use [keyfile] instead of eeprom\n"
             "   -d                  Run as daemon\n"
+            "   -u [ms]             Latency target for pipelined CHUP (default %d)\n"
+            "   -o [keyfile]        Encrypt CHAL transcripts in software, with the\n"
+            "                       test OTP key (32 hex digits) in [keyfile]\n"
             "   -h                  Print this help text\n"
-            , name);
+            , name, CHUP_TARGET_MS);
 }
 
 static void cleanup(int arg) {
@@ -28,7 +31,7 @@ int main(int argc, char **argv) {
 
     bzero(keyfile, sizeof(keyfile));
 
-    while(-1 != (ch=getopt(argc, argv, "dhk:"))) {
+    while(-1 != (ch=getopt(argc, argv, "dhk:o:u:"))) {
         switch(ch) {
 
             case 'k':
@@ -39,6 +42,15 @@ int main(int argc, char **argv) {
                 as_daemon = 1;
                 break;
 
+            case 'u':
+                chupTargetMs = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'o':
+                if(offloadSoftKey(optarg))
+                    exit(1);
+                break;
+
             case 'h':
             default:
                 print_help(argv[0]);
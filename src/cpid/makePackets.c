@@ -59,24 +59,21 @@ struct privKeyInFlash *setKey(unsigned int keyNumber) {
   return(retval);
 }
 
-int outputPublicKey(unsigned int keyNumber) {
+int outputPublicKey(struct cpResp *r, unsigned int keyNumber) {
   struct pubKeyVer3Pkt keypkt;
   struct privKeyInFlash *flashKey;
-  struct writer_cb_parm_s writer;
   int i;
 
-  memset(&writer, 0, sizeof(writer));
-
   if( keyNumber >= MAXKEYS ) {
-    CPputs( "FAIL" ); 
-    CPputc( ASCII_EOF );
+    respStatus( r, "FAIL", "FAIL" );
+    respEnd( r );
     return -1;
   }
 
   flashKey = setKey(keyNumber);
   if( flashKey == NULL ) {
-    CPputs( "FAIL" ); 
-    CPputc( ASCII_EOF );
+    respStatus( r, "FAIL", "FAIL" );
+    respEnd( r );
     return -1; // crash on null per ET
   }
 
@@ -102,10 +99,9 @@ int outputPublicKey(unsigned int keyNumber) {
   for( i = 0; i < 4; i++ ) {
     keypkt.e[i] = flashKey->e[i];
   }
-  base64_writer( &writer, &keypkt, sizeof(keypkt), "PGP PUBLIC KEY BLOCK" );
-  base64_finish_write(&writer, "PGP PUBLIC KEY BLOCK" );
+  respData( r, &keypkt, sizeof(keypkt), "PGP PUBLIC KEY BLOCK" );
 
-  CPputc( ASCII_EOF );
+  respEnd( r );
 
   return 0;
 }
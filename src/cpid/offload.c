@@ -0,0 +1,237 @@
+/*
+  Cryptoprocessor code. Compliant to spec version 1.4.
+
+  This code is released under a BSD license.
+
+  Crypto offload backends for the CHAL transcript.
+*/
+
+/***
+    Every CHAL reply ends with its transcript encrypted AES-128-CBC under
+    the OTP key, which only the DCP can use: the key is fused into the
+    part and the kernel's cryptodev driver hands it to the DCP when a
+    request carries STMP3XXX_DCP_OTPKEY.  Anywhere else -- a development
+    box, a load-test host -- there is no /dev/crypto and no OTP key.
+
+    So chalBuffFlush goes through a backend with the same shape as a
+    cryptodev session: open one, encrypt in it, close it.  There are two:
+
+      cryptodev  the kernel's /dev/crypto with the OTP-key flag, as on
+                 the chumby itself; the default.
+      soft       AES-128-CBC in-process with the library's constant-time
+                 aesEncryptCBC, under a test OTP key read from a file
+                 (cpid -o).  The transcript comes out exactly as the DCP
+                 would produce it with that key in its fuses.
+
+    A session lives for one transcript, and nothing is shared between
+    sessions but the soft backend's expanded key, which is only read, so
+    any number of crypto workers can have one open at once.
+***/
+
+#include "beecrypt/aes.h"
+
+#include "commonCrypto.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+//#include <linux/cryptodev.h>
+#include "cryptodev.h"
+
+#define OTP_KEY_LEN 16  // AES-128
+
+// flags the STMP3XXX DCP driver understands
+#define STMP3XXX_DCP_ENC    0x0001
+#define STMP3XXX_DCP_DEC    0x0002
+#define STMP3XXX_DCP_ECB    0x0004
+#define STMP3XXX_DCP_CBC    0x0008
+#define STMP3XXX_DCP_CBC_INIT   0x0010
+#define STMP3XXX_DCP_OTPKEY 0x0020
+/* hash flags */
+#define STMP3XXX_DCP_INIT   0x0001
+#define STMP3XXX_DCP_UPDATE 0x0002
+#define STMP3XXX_DCP_FINAL  0x0004
+
+/////////// cryptodev
+
+static int cryptodevOpen(struct offloadSession *s) {
+  struct session_op sess;
+
+  s->fd = s->cfd = -1;
+
+  /* Open the crypto device */
+  s->fd = open("/dev/crypto", O_RDWR, 0);
+  if (s->fd < 0) {
+    perror("open(/dev/crypto)");
+    return 1;
+  }
+
+  /* Clone file descriptor */
+  if (ioctl(s->fd, CRIOGET, &s->cfd)) {
+    perror("ioctl(CRIOGET)");
+    s->cfd = -1;
+    goto fail;
+  }
+
+  /* Set close-on-exec (not really neede here) */
+  if (fcntl(s->cfd, F_SETFD, 1) == -1) {
+    perror("fcntl(F_SETFD)");
+    goto fail;
+  }
+
+  /* Get crypto session for AES128 */
+  memset(&sess, 0, sizeof(sess));
+  sess.cipher = CRYPTO_CIPHER_NAME_CBC;
+  sess.alg_name = "aes";
+  sess.alg_namelen = strlen(sess.alg_name);
+  sess.keylen = OTP_KEY_LEN;
+  // sess.key = data.key; // key is the OTP key
+  if (ioctl(s->cfd, CIOCGSESSION, &sess)) {
+    perror("ioctl(CIOCGSESSION)");
+    goto fail;
+  }
+  s->ses = sess.ses;
+  return 0;
+
+ fail:
+  if (s->cfd >= 0)
+    close(s->cfd);
+  close(s->fd);
+  s->fd = s->cfd = -1;
+  return 1;
+}
+
+static int cryptodevEncrypt(struct offloadSession *s, void *dst, const void *src, unsigned int len, octet *iv) {
+  struct crypt_op cryp;
+
+  memset(&cryp, 0, sizeof(cryp));
+  cryp.ses = s->ses;
+  cryp.len = len;
+  cryp.src = (char *) src;
+  cryp.dst = dst;
+  cryp.iv = (char *) iv;
+  cryp.op = COP_ENCRYPT;
+  cryp.flags = STMP3XXX_DCP_OTPKEY; // use the user un-readable OTP key
+  if (ioctl(s->cfd, CIOCCRYPT, &cryp)) {
+    perror("ioctl(CIOCCRYPT)");
+    return 1;
+  }
+  return 0;
+}
+
+static int cryptodevClose(struct offloadSession *s) {
+  int ret = 0;
+
+  /* Finish crypto session */
+  if (ioctl(s->cfd, CIOCFSESSION, &s->ses)) {
+    perror("ioctl(CIOCFSESSION)");
+    ret = 1;
+  }
+
+  /* Close cloned descriptor */
+  if (close(s->cfd)) {
+    perror("close(cfd)");
+    ret = 1;
+  }
+
+  /* Close the original descriptor */
+  if (close(s->fd)) {
+    perror("close(fd)");
+    ret = 1;
+  }
+
+  s->fd = s->cfd = -1;
+  return ret;
+}
+
+const struct offloadBackend offloadCryptodev = {
+  "cryptodev", cryptodevOpen, cryptodevEncrypt, cryptodevClose
+};
+
+/////////// soft
+
+static aesParam softKey;  // expanded once by offloadSoftKey, read-only after
+
+static int softOpen(struct offloadSession *s) {
+  s->fd = s->cfd = -1;
+  s->ses = 0;
+  return 0;
+}
+
+static int softEncrypt(struct offloadSession *s, void *dst, const void *src, unsigned int len, octet *iv) {
+  aesParam ap;
+  uint32_t buf[256];  // 1K, a whole transcript in one go
+  unsigned int n;
+  int ret = 0;
+
+  if( len % OTP_KEY_LEN )
+    return 1;
+
+  // a private copy, since CBC keeps its chaining block in the parameters
+  ap = softKey;
+  aesSetIV(&ap, iv);
+
+  // aesEncryptCBC wants whole 32-bit words, which the caller's bytes
+  // needn't be, so they go through buf
+  for( ; len > 0 && ret == 0; len -= n ) {
+    n = len < sizeof(buf) ? len : sizeof(buf);
+    memcpy(buf, src, n);
+    ret = aesEncryptCBC(&ap, buf, buf, n / OTP_KEY_LEN);
+    memcpy(dst, buf, n);
+    src = (const octet *) src + n;
+    dst = (octet *) dst + n;
+  }
+  memcpy(iv, ap.fdback, OTP_KEY_LEN);  // like the kernel, hand back the last block
+
+  memset(&ap, 0, sizeof(ap));
+  memset(buf, 0, sizeof(buf));
+  return ret;
+}
+
+static int softClose(struct offloadSession *s) {
+  return 0;
+}
+
+const struct offloadBackend offloadSoft = {
+  "soft", softOpen, softEncrypt, softClose
+};
+
+/////////// selection
+
+static const struct offloadBackend *offloadCurrent = &offloadCryptodev;
+
+const struct offloadBackend *offloadBackend() {
+  return offloadCurrent;
+}
+
+// reads a test OTP key, 32 hex digits, from fname and switches to the
+// soft backend; returns 0 on success
+int offloadSoftKey(const char *fname) {
+  FILE *f;
+  octet key[OTP_KEY_LEN];
+  unsigned int b;
+  int i, ret = -1;
+
+  f = fopen(fname, "r");
+  if( f == NULL ) {
+    perror(fname);
+    return -1;
+  }
+
+  for( i = 0; i < OTP_KEY_LEN; i++ ) {
+    if( fscanf(f, " %2x", &b) != 1 )
+      break;
+    key[i] = b;
+  }
+  if( i == OTP_KEY_LEN && aesSetup(&softKey, key, 8 * OTP_KEY_LEN, ENCRYPT) == 0 ) {
+    offloadCurrent = &offloadSoft;
+    ret = 0;
+  } else {
+    fprintf(stderr, "%s: want an AES-128 key as 32 hex digits\n", fname);
+  }
+
+  fclose(f);
+  memset(key, 0, sizeof(key));
+  return ret;
+}
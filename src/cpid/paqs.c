@@ -0,0 +1,203 @@
+/*
+  Cryptoprocessor code. Compliant to spec version 1.4.
+
+  This code is released under a BSD license.
+
+  Background precomputation of PAQS(OK), the owner key encrypted to the
+  AQS public key.
+*/
+
+/***
+    PAQS(OK) is the single most expensive piece of a CHAL that does not
+    depend on anything the host sends us: it's a PKCS#1 type-2 pad of the
+    current owner key followed by a 2048-bit rsapub under the AQS key.
+    Every ciphertext has to carry fresh random padding, but nothing stops
+    us from computing a few of them before the challenge arrives.
+
+    So we keep a small ready-queue of ciphertexts, filled by a worker
+    thread that only runs when the box is otherwise idle.  Rules:
+    1. Each ciphertext is handed out exactly once and wiped when taken.
+    2. Each ciphertext is tagged with the OK index it was made for; if the
+       OK index changes, the whole queue is flushed.
+    3. If the queue is empty, the caller computes one inline, exactly as
+       doChal always has.
+
+    Memory cost is PAQS_QUEUE_DEPTH * ~260 bytes of static storage.
+***/
+
+#include "beecrypt/rsa.h"
+
+#include "commonCrypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define PAQS_QUEUE_DEPTH 4
+#define PS_LEN    (PAQS_LEN - OK_SIZE - 3)   // octet PS length = k - mLen - 3 = 256 - 16 - 3 = 237
+
+struct paqsEntry {
+  unsigned int OKnum;
+  octet        c[PAQS_LEN];
+};
+
+static struct paqsEntry paqsQueue[PAQS_QUEUE_DEPTH];
+static unsigned int paqsHead = 0;    // next entry to hand out
+static unsigned int paqsCount = 0;   // number of ready entries
+static pthread_mutex_t paqsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t paqsWake = PTHREAD_COND_INITIALIZER;
+static pthread_t paqsThread;
+static int paqsStarted = 0;
+
+/*
+  Computes one PAQS(OK) ciphertext for owner key OKnum into out, which must
+  hold PAQS_LEN octets.  Returns 0 on success.
+*/
+int paqsCompute(octet *out, unsigned int OKnum) {
+  struct machDataInFlash *mdat = MACHDATABASE;
+  octet rand_oct[16];
+  octet *m_os = NULL;
+  mpnumber m;
+  mpnumber cipher;
+  rsakp keypair;
+  unsigned int i, j;
+  int retval = -1;
+
+  if( OKnum >= NUM_OK )
+    return -1;
+
+  mpnzero(&m);
+  mpnzero(&cipher);
+  rsakpInit(&keypair);
+
+  // build the padded m
+  m_os = calloc(PAQS_LEN, 1);
+  if( m_os == NULL ) goto cleanup;
+  i = 0;
+  m_os[i++] = 0x00;
+  m_os[i++] = 0x02;
+  for( ; i < PS_LEN + 2; i++ ) {
+    do { // generate a single, non-zero byte by repeatedly calling the prng until you get a non-zero value in byte 0
+      if( getRandom( rand_oct ) != 0 ) goto cleanup;
+    } while( rand_oct[0] == 0x00 );
+    // assign this non-zero byte to m_os
+    m_os[i] = rand_oct[0];
+  }
+  m_os[i++] = 0x00;
+  for( j = 0; i < PAQS_LEN; i++, j++ ) {
+    m_os[i] = (octet) mdat->OK[OKnum][j];  // copy through the OK into m
+  }
+  if( mpnsetbin(&m, (byte *) m_os, PAQS_LEN) != 0 ) goto cleanup;
+
+  if( mpnsetbin(&keypair.e, mdat->AQSe, 4) != 0 ) goto cleanup;
+  if( mpbsetbin(&keypair.n, mdat->AQSn, 256) != 0) goto cleanup;
+
+  if( rsapub(&keypair.n, &keypair.e, &m, &cipher) ) goto cleanup;
+  if( i2osp( out, PAQS_LEN, cipher.data, cipher.size ) != 0 ) goto cleanup;
+
+  retval = 0;
+
+ cleanup:
+  if( m_os != NULL ) {
+    memset(m_os, 0, PAQS_LEN);  // the OK was in here
+    free(m_os);
+  }
+  memset(rand_oct, 0, sizeof(rand_oct));
+  mpnfree(&m);
+  mpnfree(&cipher);
+  rsakpFree(&keypair);
+  return retval;
+}
+
+// drop every queued ciphertext. call with paqsLock held.
+static void paqsFlush() {
+  memset(paqsQueue, 0, sizeof(paqsQueue));
+  paqsHead = 0;
+  paqsCount = 0;
+}
+
+static void *paqsWorker(void *arg) {
+  struct paqsEntry e;
+
+#ifdef SCHED_IDLE
+  {
+    // only run when nothing else wants the CPU
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+  }
+#endif
+
+  while(1) {
+    pthread_mutex_lock(&paqsLock);
+    while( paqsCount >= PAQS_QUEUE_DEPTH )
+      pthread_cond_wait(&paqsWake, &paqsLock);
+    pthread_mutex_unlock(&paqsLock);
+
+    e.OKnum = getOKnum();
+    if( paqsCompute(e.c, e.OKnum) != 0 ) {
+      // something is wrong with the key data; don't spin on it
+      memset(&e, 0, sizeof(e));
+      sleep(1);
+      continue;
+    }
+
+    pthread_mutex_lock(&paqsLock);
+    if( paqsCount > 0 && paqsQueue[paqsHead].OKnum != e.OKnum )
+      paqsFlush(); // OK index moved on while we were computing
+    if( paqsCount < PAQS_QUEUE_DEPTH ) {
+      paqsQueue[(paqsHead + paqsCount) % PAQS_QUEUE_DEPTH] = e;
+      paqsCount++;
+    }
+    pthread_mutex_unlock(&paqsLock);
+    memset(&e, 0, sizeof(e));
+  }
+
+  return NULL;
+}
+
+/*
+  Starts the background worker. Safe to call more than once; MACHDATABASE
+  must be set up before the first call.
+*/
+void paqsStart() {
+  pthread_mutex_lock(&paqsLock);
+  paqsFlush();  // machine data may have been reloaded
+  if( !paqsStarted ) {
+    if( pthread_create(&paqsThread, NULL, paqsWorker, NULL) == 0 ) {
+      pthread_detach(paqsThread);
+      paqsStarted = 1;
+    } else {
+      perror("Unable to start PAQS worker, computing inline");
+    }
+  }
+  pthread_mutex_unlock(&paqsLock);
+}
+
+/*
+  Hands out a fresh PAQS(OK) ciphertext for owner key OKnum, taken from the
+  ready-queue if one is available and computed inline otherwise.
+  Returns 0 on success.
+*/
+int paqsGet(octet *out, unsigned int OKnum) {
+  struct paqsEntry *e;
+
+  pthread_mutex_lock(&paqsLock);
+  if( paqsCount > 0 && paqsQueue[paqsHead].OKnum != OKnum )
+    paqsFlush();
+  if( paqsCount > 0 ) {
+    e = &paqsQueue[paqsHead];
+    memcpy(out, e->c, PAQS_LEN);
+    memset(e, 0, sizeof(*e));  // used exactly once
+    paqsHead = (paqsHead + 1) % PAQS_QUEUE_DEPTH;
+    paqsCount--;
+    pthread_cond_signal(&paqsWake);
+    pthread_mutex_unlock(&paqsLock);
+    return 0;
+  }
+  pthread_cond_signal(&paqsWake);
+  pthread_mutex_unlock(&paqsLock);
+
+  return paqsCompute(out, OKnum);
+}
@@ -0,0 +1,167 @@
+/*
+  Cryptoprocessor code. Compliant to spec version 1.4.
+
+  This code is released under a BSD license.
+
+  Response writer shared by the text and binary framings of the protocol.
+*/
+
+/***
+    Every command handler writes its reply through a struct cpResp, so the
+    same handler code serves both framings:
+
+    text (default): exactly what cpid has always sent -- a 4 character
+       response code, the payload base64'd by base64_writer, and ASCII_EOF.
+       Each field goes out on the socket in one write as soon as it is
+       encoded, so a client can start on the front of a RESP (PAQS(OK),
+       rm, vers) while the signature behind it is still being computed.
+
+    binary (negotiated with BINF): one frame per reply,
+         [cmd 4 octets][len 2 octets, big-endian][len octets of payload]
+       where the payload is the raw octets the text framing would have
+       base64'd.  Since the length goes first, the payload is collected
+       in a heap buffer and the frame is written out by respEnd.
+       A deferred reply (one built on a crypto worker) stops short of
+       writing; the I/O thread sends it later with respFlush.
+
+    tagged (negotiated with PIPE): like binary, but every frame carries
+       the 2 octet sequence tag of the request it answers,
+         [cmd 4 octets][tag 2 octets][len 2 octets][payload]
+       so replies can go out in a different order than the requests.
+***/
+
+#include "commonCrypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void respInit(struct cpResp *r, int mode, const char *cmd) {
+  memset(r, 0, sizeof(*r));
+  r->mode = mode;
+  if( cmd != NULL )
+    memcpy(r->cmd, cmd, 4);
+}
+
+// append raw octets to the binary payload buffer
+static int respAppend(struct cpResp *r, const void *data, size_t count) {
+  octet *nbuf;
+  unsigned int ncap;
+
+  if( r->failed )
+    return -1;
+  if( r->len + count > FRAME_MAXLEN ) {
+    r->failed = 1;
+    return -1;
+  }
+  if( r->len + count > r->cap ) {
+    ncap = r->cap ? r->cap : 256;
+    while( ncap < r->len + count )
+      ncap *= 2;
+    nbuf = realloc(r->buf, ncap);
+    if( nbuf == NULL ) {
+      r->failed = 1;
+      return -1;
+    }
+    r->buf = nbuf;
+    r->cap = ncap;
+  }
+  memcpy(r->buf + r->len, data, count);
+  r->len += count;
+  return 0;
+}
+
+/*
+  Starts a reply with response code cmd (e.g. "RESP").
+*/
+void respBegin(struct cpResp *r, char *cmd) {
+  memcpy(r->cmd, cmd, 4);
+  if( r->mode == CP_MODE_TEXT ) {
+    CPhold();  // goes out with the first field
+    CPputs( cmd );
+  }
+}
+
+/*
+  Emits one payload field. In text mode this is a complete base64 block,
+  PEM armored if pem_name is given, and it is on the wire when this
+  returns.
+*/
+void respData(struct cpResp *r, const void *data, size_t count, char *pem_name) {
+  struct writer_cb_parm_s writer;
+
+  if( r->mode != CP_MODE_TEXT ) {
+    respAppend(r, data, count);
+    return;
+  }
+  memset(&writer, 0, sizeof(writer));
+  CPhold();
+  base64_writer( &writer, data, count, pem_name );
+  base64_finish_write( &writer, pem_name );
+  CPflush();
+}
+
+/*
+  Reports a status instead of (or in the middle of) a reply. Text mode
+  sends text as-is, binary mode throws away any payload collected so far
+  and replies with an empty frame carrying code.
+*/
+void respStatus(struct cpResp *r, char *code, char *text) {
+  if( r->mode == CP_MODE_TEXT ) {
+    CPputs( text );
+    return;
+  }
+  memcpy(r->cmd, code, 4);
+  r->len = 0;
+  r->failed = 0;
+}
+
+/*
+  Caps the reply: ASCII_EOF in text mode, the whole frame in binary mode.
+*/
+void respEnd(struct cpResp *r) {
+  if( r->ended )
+    return;
+  r->ended = 1;
+
+  if( r->mode == CP_MODE_TEXT ) {
+    CPputc( ASCII_EOF );
+    CPflush();
+    return;
+  }
+
+  if( r->failed ) {
+    memcpy(r->cmd, "FAIL", 4);
+    r->len = 0;
+  }
+  if( !r->deferred )
+    respFlush(r, 1);
+}
+
+/*
+  Writes out a finished binary frame if send is set, and releases it
+  either way.
+*/
+void respFlush(struct cpResp *r, int send) {
+  octet hdr[FRAME_TAG_HDR_LEN];
+  int hlen = 4;
+
+  if( send && r->mode != CP_MODE_TEXT ) {
+    memcpy(hdr, r->cmd, 4);
+    if( r->mode == CP_MODE_TAGGED ) {
+      hdr[hlen++] = (r->tag >> 8) & 0xFF;
+      hdr[hlen++] = r->tag & 0xFF;
+    }
+    hdr[hlen++] = (r->len >> 8) & 0xFF;
+    hdr[hlen++] = r->len & 0xFF;
+    CPwrite(hdr, hlen);
+    if( r->len )
+      CPwrite(r->buf, r->len);
+  }
+
+  if( r->buf != NULL ) {
+    memset(r->buf, 0, r->cap);
+    free(r->buf);
+  }
+  r->buf = NULL;
+  r->len = r->cap = 0;
+}
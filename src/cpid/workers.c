@@ -0,0 +1,339 @@
+/*
+  Cryptoprocessor code. Compliant to spec version 1.4.
+
+  This code is released under a BSD license.
+
+  Pool of crypto workers for pipelined connections.
+*/
+
+/***
+    On a pipelined (PIPE) connection replies may go out in any order, so
+    there is no reason for a VERS or TIME to wait behind a CHAL that is
+    grinding through its modexps.  The I/O thread keeps reading and
+    answering the cheap commands itself, and hands challenges to a small
+    pool of worker threads, one per online CPU.
+
+    Each worker has a pair of single-producer/single-consumer rings:
+      todo: the I/O thread pushes jobs, the worker pops them
+      done: the worker pushes finished jobs, the I/O thread pops them
+    so neither side ever takes a lock to pass work around.  An idle worker
+    sleeps on a semaphore, and a worker that finishes a job pokes a pipe
+    so the I/O thread can sleep in poll() on the socket and the pipe at
+    the same time.
+
+    Workers never touch the socket.  A finished job carries its reply in a
+    deferred cpResp, and the I/O thread sends it (or drops it, if the
+    client that asked has gone away) with respFlush.
+
+    Everything a job needs is in the job: bignums, sha1Param and the CHAL
+    transcript are all locals of the command cores, and getRandom chains
+    its state per thread.  paqsGet, the one shared piece, does its own
+    locking.
+
+    A CHLB carries several signatures that can run side by side.  Those
+    go to a second, fixed set of helper threads with workersFanOut: the
+    thread that owns the batch signs entries too, and the helpers take
+    whatever entries are left.  There are never more helpers than CPUs
+    less one, so batches from several workers queue for the same helpers
+    rather than each starting threads of its own.
+***/
+
+#include "commonCrypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define WORKER_MAX   4   // most workers we'll start, whatever the CPU count
+#define WORKER_RING  4   // jobs outstanding per worker; a power of 2
+
+struct spscRing {
+  volatile unsigned int head;   // written by the consumer only
+  volatile unsigned int tail;   // written by the producer only
+  struct cpJob *slot[WORKER_RING];
+};
+
+struct worker {
+  pthread_t        thread;
+  sem_t            wake;
+  struct spscRing  todo;
+  struct spscRing  done;
+  unsigned int     outstanding;   // submitted and not yet reaped; I/O thread only
+};
+
+static struct worker workers[WORKER_MAX];
+static int workerCount = 0;
+static int wakePipe[2] = { -1, -1 };
+
+// one workersFanOut call, on the fan list until all its entries are claimed
+struct fanOut {
+  void          (*run)(void *arg, unsigned int i);
+  void           *arg;
+  unsigned int    n;
+  unsigned int    next;       // first unclaimed entry
+  unsigned int    finished;   // entries done, by anybody
+  struct fanOut  *link;
+};
+
+static pthread_once_t  fanOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t fanLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  fanWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  fanDone = PTHREAD_COND_INITIALIZER;
+static struct fanOut  *fanList = NULL;
+
+// producer side; fails if the ring is full
+static int ringPush(struct spscRing *ring, struct cpJob *job) {
+  unsigned int tail = ring->tail;
+
+  if( tail - ring->head == WORKER_RING )
+    return -1;
+  ring->slot[tail & (WORKER_RING - 1)] = job;
+  __sync_synchronize();  // the slot has to be visible before the new tail
+  ring->tail = tail + 1;
+  return 0;
+}
+
+// consumer side; NULL if the ring is empty
+static struct cpJob *ringPop(struct spscRing *ring) {
+  unsigned int head = ring->head;
+  struct cpJob *job;
+
+  if( head == ring->tail )
+    return NULL;
+  __sync_synchronize();  // don't read the slot before we've seen the tail
+  job = ring->slot[head & (WORKER_RING - 1)];
+  ring->slot[head & (WORKER_RING - 1)] = NULL;
+  __sync_synchronize();  // done with the slot before handing it back
+  ring->head = head + 1;
+  return job;
+}
+
+static void *workerMain(void *arg) {
+  struct worker *w = arg;
+  struct cpJob *job;
+  char c = 0;
+
+  while(1) {
+    while( sem_wait(&w->wake) != 0 && errno == EINTR )
+      ;
+    job = ringPop(&w->todo);
+    if( job == NULL )
+      continue;
+    job->run(job);
+    ringPush(&w->done, job);  // can't be full, see workersSubmit
+    if( write(wakePipe[1], &c, 1) != 1 && errno != EAGAIN )
+      perror("Unable to wake the I/O thread");
+  }
+
+  return NULL;
+}
+
+/*
+  Starts one worker per online CPU (at most WORKER_MAX). Returns the
+  number started; with none, callers do all the work inline as before.
+*/
+int workersStart() {
+  long ncpu;
+  int i;
+
+  if( workerCount > 0 )
+    return workerCount;
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if( ncpu < 1 )
+    ncpu = 1;
+  if( ncpu > WORKER_MAX )
+    ncpu = WORKER_MAX;
+
+  if( pipe(wakePipe) != 0 ) {
+    perror("Unable to create worker wake pipe, computing inline");
+    return 0;
+  }
+  fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+
+  for( i = 0; i < ncpu; i++ ) {
+    memset(&workers[i], 0, sizeof(struct worker));
+    if( sem_init(&workers[i].wake, 0, 0) != 0 )
+      break;
+    if( pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]) != 0 ) {
+      sem_destroy(&workers[i].wake);
+      break;
+    }
+    pthread_detach(workers[i].thread);
+  }
+  workerCount = i;
+  if( workerCount == 0 ) {
+    perror("Unable to start crypto workers, computing inline");
+    close(wakePipe[0]); close(wakePipe[1]);
+    wakePipe[0] = wakePipe[1] = -1;
+  }
+  return workerCount;
+}
+
+int workersRunning() {
+  return workerCount;
+}
+
+/*
+  Readable whenever a finished job may be waiting, for poll(). -1 if
+  there are no workers.
+*/
+int workersWakeFd() {
+  return wakePipe[0];
+}
+
+/*
+  1 if every worker already has WORKER_RING jobs outstanding, so
+  workersSubmit would fail. 0 with no workers. I/O thread only.
+*/
+int workersFull() {
+  int i;
+
+  for( i = 0; i < workerCount; i++ ) {
+    if( workers[i].outstanding < WORKER_RING )
+      return 0;
+  }
+  return workerCount > 0;
+}
+
+/*
+  Hands job to the least busy worker. Returns 0 if it was queued, -1 if
+  every worker already has WORKER_RING jobs outstanding. I/O thread only.
+*/
+int workersSubmit(struct cpJob *job) {
+  struct worker *w = NULL;
+  int i;
+
+  for( i = 0; i < workerCount; i++ ) {
+    if( workers[i].outstanding < WORKER_RING &&
+	(w == NULL || workers[i].outstanding < w->outstanding) )
+      w = &workers[i];
+  }
+  if( w == NULL )
+    return -1;
+
+  // outstanding also counts jobs sitting in done, so neither ring can fill
+  ringPush(&w->todo, job);
+  w->outstanding++;
+  sem_post(&w->wake);
+  return 0;
+}
+
+/*
+  Returns the next finished job, or NULL if there are none right now.
+  I/O thread only; the job belongs to the caller again.
+*/
+struct cpJob *workersDone() {
+  struct cpJob *job;
+  char drain[16];
+  int i;
+
+  if( workerCount == 0 )
+    return NULL;
+
+  // empty the pipe before looking, so a job finished after we look
+  // still leaves the pipe readable
+  while( read(wakePipe[0], drain, sizeof(drain)) > 0 )
+    ;
+
+  for( i = 0; i < workerCount; i++ ) {
+    job = ringPop(&workers[i].done);
+    if( job != NULL ) {
+      workers[i].outstanding--;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+// takes f off the fan list; fanLock held
+static void fanUnlink(struct fanOut *f) {
+  struct fanOut **p;
+
+  for( p = &fanList; *p != NULL; p = &(*p)->link ) {
+    if( *p == f ) {
+      *p = f->link;
+      return;
+    }
+  }
+}
+
+// runs one unclaimed entry of f, if there is one; fanLock held, and
+// dropped around the entry itself. Returns 0 if f had nothing left.
+static int fanStep(struct fanOut *f) {
+  unsigned int i;
+
+  if( f->next >= f->n ) {
+    fanUnlink(f);
+    return 0;
+  }
+  i = f->next++;
+  pthread_mutex_unlock(&fanLock);
+  f->run(f->arg, i);
+  pthread_mutex_lock(&fanLock);
+  // f can't go away before this: its owner waits for finished == n
+  if( ++f->finished == f->n )
+    pthread_cond_broadcast(&fanDone);
+  return 1;
+}
+
+static void *fanMain(void *arg) {
+  pthread_mutex_lock(&fanLock);
+  while(1) {
+    while( fanList == NULL )
+      pthread_cond_wait(&fanWork, &fanLock);
+    fanStep(fanList);
+  }
+  return NULL;
+}
+
+static void fanStart() {
+  pthread_t thread;
+  long ncpu;
+  int i;
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if( ncpu > WORKER_MAX )
+    ncpu = WORKER_MAX;
+  // the caller of workersFanOut is busy too, so one less than the CPUs
+  for( i = 1; i < ncpu; i++ ) {
+    if( pthread_create(&thread, NULL, fanMain, NULL) != 0 )
+      break;
+    pthread_detach(thread);
+  }
+}
+
+/*
+  Calls run(arg, i) for every i below n, spread over the calling thread
+  and the fan-out helpers, and returns once all n calls have returned.
+  Any thread may call this. With one CPU, or no helpers, every call is
+  made right here in order.
+*/
+void workersFanOut(void (*run)(void *arg, unsigned int i), void *arg, unsigned int n) {
+  struct fanOut f;
+
+  if( n == 0 )
+    return;
+  pthread_once(&fanOnce, fanStart);
+
+  memset(&f, 0, sizeof(f));
+  f.run = run;
+  f.arg = arg;
+  f.n = n;
+
+  pthread_mutex_lock(&fanLock);
+  if( n > 1 ) {
+    f.link = fanList;
+    fanList = &f;
+    pthread_cond_broadcast(&fanWork);
+  }
+  while( fanStep(&f) )
+    ;
+  while( f.finished < f.n )
+    pthread_cond_wait(&fanDone, &fanLock);
+  pthread_mutex_unlock(&fanLock);
+}